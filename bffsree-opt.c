@@ -8,10 +8,28 @@
 // optimization macros
 #define _bfe_(e,c)            do { (e).cmd=(uint8_t)(c); } while(0)
 #define _bfe_v(e,c,v)         do { (e).cmd=(uint8_t)(c); (e).val=(int32_t)(v); } while(0)
-#define _bfe_vo(e,c,v,o)      do { (e).cmd=(uint8_t)(c); (e).val=(int32_t)(v); (e).off=(bf_off_t)(o); (e).buf=0; } while(0)
-#define _bfe_vob(e,c,v,o,b)   do { (e).cmd=(uint8_t)(c); (e).val=(int32_t)(v); (e).off=(bf_off_t)(o); (e).buf=(bf_op_buf_t)(b); } while(0)
-
-static int progscan(int* ptroff, char* chars, int pc, int proglen, int plusTok, int minusTok) {
+#define _bfe_vo(e,c,v,o)      do { (e).cmd=(uint8_t)(c); (e).val=(int32_t)(v); (e).off=(bf_off_t)(o); (e).buf=0; (e).arg=0; } while(0)
+#define _bfe_vob(e,c,v,o,b)   do { (e).cmd=(uint8_t)(c); (e).val=(int32_t)(v); (e).off=(bf_off_t)(o); (e).buf=(bf_op_buf_t)(b); (e).arg=0; } while(0)
+#define _bfe_voba(e,c,v,o,b,a) do { _bfe_vob(e,c,v,o,b); (e).arg=(bf_off_t)(a); } while(0)
+
+// shortest run worth a bulk op
+#ifndef BF_OPT_BULK_MIN
+#define BF_OPT_BULK_MIN 3
+#endif
+
+// constant blocks: fewest ops replaced, most cells spanned (fits an 8-bit buf)
+#ifndef BF_OPT_VEC_MIN
+#define BF_OPT_VEC_MIN 4
+#endif
+#define BF_OPT_VEC_MAX 128
+
+// multiply fan-out: fewest targets, widest window (cells)
+#ifndef BF_OPT_FAN_MIN
+#define BF_OPT_FAN_MIN 4
+#endif
+#define BF_OPT_FAN_MAX 32
+
+static int progscan(int* ptroff, const char* chars, int pc, int proglen, int plusTok, int minusTok) {
     int c, ci = 0;
     while (pc + 1 < proglen && _myabs(ci) < 126) {
         c = (unsigned char)chars[pc + 1];
@@ -30,11 +48,22 @@ static int progscan(int* ptroff, char* chars, int pc, int proglen, int plusTok,
 // =====================================================================
 // brainfuck - loop optimization (original version)
 // =====================================================================
-static int optimizeLoop(bf_op* bfo, int s) {
+// open loop while compiling: FWD position, outer sp, profile id, and the
+// last op optimizeLoop can't take as of the '['
+typedef struct bf_optLoop { int l, sp, id, bad; } bf_optLoop;
+
+// ops optimizeLoop may find in a body it rewrites
+static int optimizeLoopOp(int cmd) {
+    return cmd == bfo_VAL || cmd == bfo_VAL_MUL || cmd == bfo_VAL_MZ || cmd == bfo_VAL_ZERO;
+}
+
+// solve: also close loops whose counter steps by an odd k != -1 -- the
+// trip count is then x * inverse(-k) mod 256 (8-bit wrapping cells only)
+static int optimizeLoop(bf_Arena* ar, bf_op* bfo, int s, int solve) {
     int pc = s;
     int canopt = 1;
-    int lc = 0;
-    int skip, rc, sp, nsp, haszero = 0;
+    int lc = 0, inv = 1;
+    int skip, rc, sp, nsp, haszero = 0, hasmul = 0;
     enum ebfo_CMD cmd;
     bf_op *opptr, opstack[128];
     char vtrackspace[512] = {0};
@@ -55,6 +84,8 @@ static int optimizeLoop(bf_op* bfo, int s) {
     #define _loop_var(a) (((a) & 7) > 2)  // once modified, we can't read safely
     minsp = maxsp = sp;
     while (canopt && (cmd = (enum ebfo_CMD)bfo[pc].cmd) != bfo_REW) {
+        // cells touched must stay inside vtrack
+        if (_myabs(sp) > 127 || _myabs(sp + bfo[pc].buf) > 127) { canopt = 0; break; }
         if (sp > maxsp) maxsp = sp;
         if (sp < minsp) minsp = sp;
         switch (cmd) {
@@ -69,10 +100,12 @@ static int optimizeLoop(bf_op* bfo, int s) {
             vtrack[sp + bfo[pc].buf] |= 2 | 1;
             vtrack[sp] |= 1;
             if (sp == 0) canopt = 0;
+            hasmul = 1;
             break;
 
         case bfo_VAL_MZ:
             if (_loop_var(vtrack[sp + bfo[pc].buf])) canopt = 0;
+            hasmul = 1;
             // fall through
 
         case bfo_VAL_ZERO:
@@ -101,15 +134,23 @@ static int optimizeLoop(bf_op* bfo, int s) {
         pc++;
     }
 
-    // has to be a simple loop -- balanced and dec by 1
-    if (canopt == 0 || sp != 0 || lc != -1 || (vtrack[0] & 2) == 2)
+    // has to be a simple loop -- balanced and dec by 1 (or solvable: an
+    // inner move/multiply empties its source on the first pass, so it can't
+    // be scaled by the trip count)
+    if (canopt == 0 || sp != 0 || (vtrack[0] & 2) == 2)
         return -1;
+    if (lc != -1) {
+        if (!solve || BF_CELL_BITS != 8 || !BF_CELL_MOD_POW2 || (lc & 1) == 0 || hasmul)
+            return -1;
+        for (rc = (-lc) & 255; ((rc * inv) & 255) != 1; inv += 2);
+    }
 
     // ============================
     // Optimize the loop
     // ============================
     rc = (int)(sizeof(*opptr) * (size_t)(pc - s + 1));
-    opptr = (rc <= (int)(sizeof(*opptr) * sizeof(opstack))) ? opstack : (bf_op*)malloc((size_t)rc);
+    opptr = (rc <= (int)sizeof(opstack)) ? opstack : (bf_op*)bf_Arena_alloc(ar, (size_t)rc);
+    if (!opptr) return -1;
     memcpy(opptr, bfo + s, (size_t)rc);
 
     // first - open
@@ -137,7 +178,7 @@ static int optimizeLoop(bf_op* bfo, int s) {
             if (sp == 0) { skip = 1; break; }
             nsp = sp;
             sp += bfo[pc].off;
-            _bfe_vob(bfo[pc], bfo_VAL_MUL, bfo[pc].val, 0, nsp);
+            _bfe_vob(bfo[pc], bfo_VAL_MUL, inv == 1 ? bfo[pc].val : (bfo[pc].val * inv) & 255, 0, nsp);
             vtrack[nsp] |= 8;
             break;
 
@@ -150,7 +191,7 @@ static int optimizeLoop(bf_op* bfo, int s) {
                 _bfe_vob(bfo[pc], bfo_NOOP, 0, nsp, 0);
                 vtrack[nsp] |= 16;
             } else {
-                _bfe_vob(bfo[pc], bfo_MUL_MUL, 1, nsp, nsp);
+                _bfe_vob(bfo[pc], bfo_MUL_MUL, inv, nsp, nsp);
                 vtrack[nsp] |= 16 | 8;
             }
             pc++;
@@ -205,56 +246,455 @@ static int optimizeLoop(bf_op* bfo, int s) {
     }
 
     // done
-    if (opptr != opstack) free(opptr);
+    if (opptr != opstack) bf_Arena_release(ar, opptr, (size_t)rc);
     return pc;
     #undef _loop_var
 }
 
+// =====================================================================
+// bulk memory idioms (runs over the finished IR, compacting it)
+// =====================================================================
+// length of a run at i of ops like bfo[i] (same cmd/val/buf) stepping dir (+-1)
+static int bulkRun(bf_op* bfo, int i, int n) {
+    int dir = bfo[i].off, j = i + 1;
+    if (dir != 1 && dir != -1) return 1;
+    while (j < n && j - i < 0x4000 &&
+           bfo[j].cmd == bfo[i].cmd && bfo[j].val == bfo[i].val && bfo[j].buf == bfo[i].buf) {
+        j++;
+        if (bfo[j - 1].off != dir) break;
+    }
+    return j - i;
+}
+
+// FWD, single op, REW with no inline deltas in between
+static int bulkWalk(bf_op* bfo, int i, int n) {
+    return i + 2 < n && bfo[i].cmd == bfo_FWD && bfo[i].val == 2 &&
+           bfo[i].buf == 0 && bfo[i].off == 0 && bfo[i + 2].cmd == bfo_REW;
+}
+
+// straight-line VAL/VAL_ZERO/NOOP ops from i as per-cell (mask, add) pairs:
+// cell = (cell & mask) + add over [lo, lo + span) around the start. Returns
+// the ops covered; every position they visit lies inside the span.
+static int vecBlock(bf_op* bfo, int i, int n, bf_cell* m, bf_cell* a, int* lo, int* span, int* end) {
+    int j, p = 0, l = 0, h = 0;
+    bf_cell* mc = m + BF_OPT_VEC_MAX;
+    bf_cell* ac = a + BF_OPT_VEC_MAX;
+
+    for (j = 0; j < 2 * BF_OPT_VEC_MAX; j++) { m[j] = (bf_cell)~(bf_cell)0; a[j] = 0; }
+    for (j = i; j < n; j++) {
+        if (bfo[j].cmd != bfo_VAL && bfo[j].cmd != bfo_VAL_ZERO && bfo[j].cmd != bfo_NOOP) break;
+        if (_mymax(h, p) - _mymin(l, p) >= BF_OPT_VEC_MAX) break;
+        l = _mymin(l, p);
+        h = _mymax(h, p);
+        if (bfo[j].cmd == bfo_VAL)       ac[p] += (bf_cell)bfo[j].val;
+        else if (bfo[j].cmd == bfo_VAL_ZERO) { mc[p] = 0; ac[p] = (bf_cell)bfo[j].val; }
+        p += bfo[j].off;
+    }
+    if ((bf_off_t)p != p) return 0;
+    *lo = l; *span = h - l + 1; *end = p;
+    return j - i;
+}
+
+// VAL_MUL run (optionally closed by a VAL_MZ) from i as one coefficient
+// vector over [lo, lo + span); the source itself gets -1 when cleared
+static int fanBlock(bf_op* bfo, int i, int n, bf_cell* k, int* lo, int* span, int* end) {
+    int j, l = 0, h = 0, b;
+    bf_cell* kc = k + BF_OPT_VEC_MAX;
+
+    for (j = 0; j < 2 * BF_OPT_VEC_MAX; j++) k[j] = 0;
+    for (j = i; j < n && (bfo[j].cmd == bfo_VAL_MUL || bfo[j].cmd == bfo_VAL_MZ); j++) {
+        b = bfo[j].buf;
+        if (!b || _mymax(h, b) - _mymin(l, b) >= BF_OPT_FAN_MAX) break;
+        l = _mymin(l, b);
+        h = _mymax(h, b);
+        kc[b] += (bf_cell)bfo[j].val;
+        if (bfo[j].cmd == bfo_VAL_MZ) { kc[0] -= 1; j++; break; }
+        if (bfo[j].off) { j++; break; }
+    }
+    if (j == i) return 0;
+    *lo = l; *span = h - l + 1; *end = bfo[j - 1].off;
+    return j - i;
+}
+
+// constant pool: vectors of x then y cells, each starting on an op slot
+typedef struct bf_pool { bf_op* ops; int n, cap; } bf_pool;
+
+static int poolAdd(bf_Arena* ar, bf_pool* pl, const bf_cell* x, const bf_cell* y, int span) {
+    size_t bytes = sizeof(bf_cell) * (size_t)((y ? 2 : 1) * span);
+    int units = (int)((bytes + sizeof(bf_op) - 1) / sizeof(bf_op)), at = pl->n;
+    bf_cell* c;
+
+    _myaresize(ar, pl->ops, pl->cap, at + units);
+    if (!pl->ops) return -1;
+    c = (bf_cell*)(pl->ops + at);
+    memset(c, 0, sizeof(bf_op) * (size_t)units);
+    memcpy(c, x, sizeof(bf_cell) * (size_t)span);
+    if (y) memcpy(c + span, y, sizeof(bf_cell) * (size_t)span);
+    pl->n += units;
+    return at;
+}
+
+// cap: ops *pbfo has room for
+static int optimizeBulk(bf_Arena* ar, bf_op** pbfo, int cap, int n) {
+    bf_op* bfo = *pbfo;
+    int* fstack = (int*)bf_Arena_alloc(ar, sizeof(int) * (size_t)(n + 1));
+    int i = 0, w = 0, f = 0, r, d, v, lo, span, end, at;
+    bf_cell m[2 * BF_OPT_VEC_MAX], a[2 * BF_OPT_VEC_MAX];
+    bf_pool pool = { 0, 0, 0 };   // MEM_VEC/MUL_VEC constants, stored after EOP
+    bf_op t;
+
+    if (!fstack) return n;
+    while (i < n) {
+        t = bfo[i];
+        r = (t.cmd == bfo_VAL_ZERO || (t.cmd == bfo_VAL_MZ && t.buf)) ? bulkRun(bfo, i, n) : 1;
+        v = (t.cmd == bfo_VAL || t.cmd == bfo_VAL_ZERO) ? vecBlock(bfo, i, n, m, a, &lo, &span, &end) :
+            (t.cmd == bfo_VAL_MUL) ? fanBlock(bfo, i, n, m, &lo, &span, &end) : 0;
+
+        if (t.cmd == bfo_VAL_MUL ? v >= BF_OPT_FAN_MIN : (v >= BF_OPT_VEC_MIN && v > r)) {
+            // +>++>+++>[-]> -> one masked add of constant vectors;
+            // [->+>++>+++>++++<<<<] -> one broadcast multiply-add
+            if (t.cmd == bfo_VAL_MUL) at = poolAdd(ar, &pool, m + BF_OPT_VEC_MAX + lo, 0, span);
+            else                      at = poolAdd(ar, &pool, m + BF_OPT_VEC_MAX + lo, a + BF_OPT_VEC_MAX + lo, span);
+            if (at < 0) { bf_Arena_release(ar, fstack, sizeof(int) * (size_t)(n + 1)); return n; }
+            _bfe_voba(bfo[w], t.cmd == bfo_VAL_MUL ? bfo_MUL_VEC : bfo_MEM_VEC, at, end, lo, span);
+            i += v;
+        } else if (r >= BF_OPT_BULK_MIN) {
+            // [-]>[-]>[-] -> one set; [->>+<<]>[->>+<<]> -> one move (arg<0 walks left)
+            d = t.off * (r - 1) + bfo[i + r - 1].off;
+            _bfe_voba(bfo[w], t.cmd == bfo_VAL_ZERO ? bfo_MEM_SET : bfo_MEM_MOVE, t.val, d, t.buf, t.off * r);
+            i += r;
+        } else if (bulkWalk(bfo, i, n) && bfo[i + 1].off &&
+                   ((bfo[i + 1].cmd == bfo_VAL_ZERO && bfo[i + 1].val == 0) ||
+                    (bfo[i + 1].cmd == bfo_VAL_MZ && bfo[i + 1].buf))) {
+            // [[-]>] -> clear until zero; [[->+<]>] -> walking move
+            t = bfo[i + 1];
+            if (t.cmd == bfo_VAL_ZERO) _bfe_vob(bfo[w], bfo_ZERO_S, t.off, 0, 0);
+            else                       _bfe_voba(bfo[w], bfo_MOVE_S, t.val, 0, t.buf, t.off);
+            t = bfo[i + 2];
+            // the REW's exit delta rides on the walk op or follows it
+            if (t.buf) { w++; _bfe_vo(bfo[w], bfo_VAL, t.buf, 0); }
+            bfo[w].off = t.off;
+            i += 3;
+        } else {
+            bfo[w] = t;
+            if (t.cmd == bfo_FWD) fstack[f++] = w;
+            else if (t.cmd == bfo_REW && f > 0) {
+                f--;
+                bfo[fstack[f]].val = w - fstack[f];
+                bfo[w].val = fstack[f] - w;
+            }
+            i++;
+        }
+        w++;
+    }
+    bf_Arena_release(ar, fstack, sizeof(int) * (size_t)(n + 1));
+
+    if (pool.n) {
+        // pool goes after the EOP slot; vector ops' val becomes a relative op offset
+        bfo = (bf_op*)bf_Arena_grow(ar, bfo, sizeof(bf_op) * (size_t)cap, sizeof(bf_op) * (size_t)(w + 1 + pool.n));
+        if (!bfo) { bf_Arena_release(ar, pool.ops, sizeof(bf_op) * (size_t)pool.cap); return -1; }
+        memcpy(bfo + w + 1, pool.ops, sizeof(bf_op) * (size_t)pool.n);
+        for (i = 0; i < w; i++)
+            if (bfo[i].cmd == bfo_MEM_VEC || bfo[i].cmd == bfo_MUL_VEC) bfo[i].val += w + 1 - i;
+        *pbfo = bfo;
+        bf_Arena_release(ar, pool.ops, sizeof(bf_op) * (size_t)pool.cap);
+    }
+    return w;
+}
+
+// =====================================================================
+// superinstructions (bffsree-super.h, regenerated by `make super`)
+// =====================================================================
+// Only the head op's cmd is rewritten: the fused ops keep their operands
+// and cmds, so a FWD/REW landing on one of them still runs it alone.
+typedef struct bf_superOp { uint8_t cmd, n, op[3], z[2]; } bf_superOp;
+
+static const bf_superOp bf_supers[] = {
+#define BF_SUPER2(a, za, b)         { bfo_S2_##a##_##za##_##b, 2, { bfo_##a, bfo_##b, 0 }, { za, 0 } },
+#define BF_SUPER3(a, za, b, zb, c)  { bfo_S3_##a##_##za##_##b##_##zb##_##c, 3, { bfo_##a, bfo_##b, bfo_##c }, { za, zb } },
+#include "bffsree-super.h"
+#undef BF_SUPER2
+#undef BF_SUPER3
+    { bfo_EOP, 0, { 0, 0, 0 }, { 0, 0 } }
+};
+
+#if !BF_NGRAMS
+// longest match wins, then table (frequency) order
+static void optimizeSuper(bf_op* bfo, int n) {
+    const bf_superOp* so;
+    int i, k, best;
+
+    for (i = 0; i < n; i++) {
+        best = -1;
+        for (so = bf_supers; so->n; so++) {
+            if (i + so->n > n || (best >= 0 && so->n <= bf_supers[best].n)) continue;
+            for (k = 0; k < so->n; k++) {
+                if (bfo[i + k].cmd != so->op[k]) break;
+                if (k + 1 < so->n && so->z[k] && bfo[i + k].off) break;
+            }
+            if (k == so->n) best = (int)(so - bf_supers);
+        }
+        if (best >= 0) {
+            bfo[i].cmd = bf_supers[best].cmd;
+            i += bf_supers[best].n - 1;
+        }
+    }
+}
+#endif
+
+// ----------------------------
+// Profile helpers
+// ----------------------------
+static uint32_t bf_hashProg(const char* chars, int proglen) {
+    uint32_t h = 2166136261u;   // FNV-1a
+    int i;
+    for (i = 0; i < proglen; i++) { h ^= (unsigned char)chars[i]; h *= 16777619u; }
+    // an unterminated program hashes as if it had its NUL
+    if (proglen == 0 || chars[proglen - 1] != 0) h *= 16777619u;
+    return h;
+}
+
+// no profile (or a loop it doesn't know) counts as hot. Hotness only
+// gates optimizeLoop's odd-step solve and the bf_RULE_HOT rules
+static int bf_loopHot(const bf_Profile* prof, int id) {
+    const bf_loopProf* lp;
+    if (!prof || id >= prof->loopCount) return 1;
+    lp = prof->loops + id;
+    return lp->entries + lp->iters >= BF_PROF_HOT;
+}
+
+// =====================================================================
+// idiom rules (matched on the source, one pass, at each rule's first char)
+// =====================================================================
+// Patterns are BF with runs bound to variables: {ka} is a run of < and >
+// totalling k*a, (kN) a run of + and - totalling k*N. A variable binds on
+// first use (k must divide the run, zero runs never match) and must agree
+// afterwards. Template fields are sums of such terms ("2a", "-a", "a+b").
+enum {
+    bf_RULE_KEEP = 1,   // ops run ahead of the loop, which is still compiled
+    bf_RULE_HOT  = 2,   // closed form: only on hot loops
+    bf_RULE_WALK = 4,   // arg is a walk stride and must not be zero
+    bf_RULE_WRAP = 8,   // the op's closed form needs cells that wrap as unsigned
+};
+
+typedef struct bf_ruleOp { uint8_t cmd; const char *val, *buf, *arg; } bf_ruleOp;
+
+typedef struct bf_rule {
+    const char* pat;
+    int         flags;
+    bf_ruleOp   ops[2];
+} bf_rule;
+
+static const bf_rule bf_rules[] = {
+    // scan: [>] [<<]
+    { "[{a}]",                  0, { { bfo_PTR_S,    "a", 0,   0 } } },
+    // clear, move/multiply
+    { "[-]",                    0, { { bfo_VAL_ZERO, 0,   0,   0 } } },
+    { "[+]",                    0, { { bfo_VAL_ZERO, 0,   0,   0 } } },
+    { "[-{a}(N){-a}]",          0, { { bfo_VAL_MZ,   "N", "a", 0 } } },
+    { "[{a}(N){-a}-]",          0, { { bfo_VAL_MZ,   "N", "a", 0 } } },
+    // if (x) { x = 0; t += N } -- flag tests, boolean not
+    { "[[-]{a}(N){-a}]",        0, { { bfo_VAL_IF,   "N", "a", 0 } } },
+    { "[{a}(N){-a}[-]]",        0, { { bfo_VAL_IF,   "N", "a", 0 } } },
+    // walk and modify: [->] [-<<] [>+>] [<+<]
+    { "[(N){a}]",               bf_RULE_WALK, { { bfo_ADD_S, "N", 0,   "a" } } },
+    { "[{a}(N){b}]",            bf_RULE_WALK, { { bfo_ADD_S, "N", "a", "a+b" } } },
+    // esolangs divmod, cells spaced a apart: >n d -> >0 d-n%d n%d n/d
+    // (no bundled benchmark contains either form: factor.b, e.b, golden.b
+    // and squares.b divide with loops of their own)
+    { "[-{a}-[{a}+{2a}]{a}[+[-{-a}+{a}]{a}+{2a}]{-5a}]",
+        bf_RULE_KEEP | bf_RULE_HOT | bf_RULE_WRAP, { { bfo_DIVMOD, "a", "a", 0 } } },
+    // n-preserving divmod: >n 0 d -> >0 n d-n%d n%d n/d
+    { "[-{a}+{a}-[{a}+{2a}]{a}[+[-{-a}+{a}]{a}+{2a}]{-6a}]",
+        bf_RULE_KEEP | bf_RULE_HOT | bf_RULE_WRAP, { { bfo_DIVMOD, "a", "2a", "a" } } },
+};
+
+#define bf_RULE_COUNT ((int)(sizeof(bf_rules) / sizeof(bf_rules[0])))
+
+static int ruleVar(int ch) {
+    if (ch >= 'a' && ch <= 'z') return ch - 'a';
+    if (ch >= 'A' && ch <= 'Z') return ch - 'A' + 26;
+    return -1;
+}
+
+// one term: [+-][digits][var]
+static const char* ruleTerm(const char* e, int* k, int* v) {
+    int sign = 1, n = 0, digits = 0;
+    if (*e == '-') { sign = -1; e++; } else if (*e == '+') e++;
+    while (*e >= '0' && *e <= '9') { n = n * 10 + (*e++ - '0'); digits = 1; }
+    *k = sign * (digits ? n : 1);
+    if ((*v = ruleVar((unsigned char)*e)) >= 0) e++;
+    return e;
+}
+
+static long ruleEval(const char* e, const int* vars) {
+    long r = 0;
+    int k, v;
+    if (!e) return 0;
+    while (*e) {
+        e = ruleTerm(e, &k, &v);
+        r += (long)k * (v >= 0 ? vars[v] : 1);
+    }
+    return r;
+}
+
+// source chars matched by rule r at rpc, 0 if none
+static int ruleMatch(const bf_rule* r, const char* chars, int rpc, int proglen, int* vars) {
+    const char* p = r->pat;
+    uint64_t bound = 0;
+    int i = rpc, k, v, run, n, up, down;
+
+    while (*p) {
+        if (*p == '{' || *p == '(') {
+            up   = (*p == '{') ? bf_GT : bf_PLUS;
+            down = (*p == '{') ? bf_LT : bf_MINUS;
+            for (run = n = 0; i < proglen; i++, n++) {
+                if ((unsigned char)chars[i] == up) run++;
+                else if ((unsigned char)chars[i] == down) run--;
+                else break;
+            }
+            p = ruleTerm(p + 1, &k, &v) + 1;
+            if (n == 0 || run == 0) return 0;
+            if (v >= 0 && !(bound & ((uint64_t)1 << v))) {
+                if (run % k) return 0;
+                vars[v] = run / k;
+                bound |= (uint64_t)1 << v;
+            } else if (run != k * (v >= 0 ? vars[v] : 1)) {
+                return 0;
+            }
+        } else {
+            if (i >= proglen || chars[i] != *p) return 0;
+            i++; p++;
+        }
+    }
+    return i - rpc;
+}
+
+// emits the first matching rule's ops; returns source chars it replaces
+// (0 for no match or a KEEP rule, whose loop is compiled as usual).
+// plain: per-cell ops only (bf_OPT_LANES), no walks or KEEP idioms
+static int optimizeRules(bf_op* bfo, int* pc, const char* chars, int rpc, int proglen, int hot, int plain) {
+    int vars[52], r, n, j;
+    long v, b, a;
+    const bf_ruleOp* ro;
+
+    for (r = 0; r < bf_RULE_COUNT; r++) {
+        if (bf_rules[r].pat[0] != chars[rpc]) continue;
+        if ((bf_rules[r].flags & bf_RULE_HOT) && !hot) continue;
+        if ((bf_rules[r].flags & (bf_RULE_WALK | bf_RULE_KEEP)) && plain) continue;
+        if ((bf_rules[r].flags & bf_RULE_WRAP) && !BF_CELL_MOD_POW2) continue;
+        if (!(n = ruleMatch(bf_rules + r, chars, rpc, proglen, vars))) continue;
+
+        for (j = 0; j < 2 && (ro = bf_rules[r].ops + j)->cmd; j++) {
+            v = ruleEval(ro->val, vars);
+            b = ruleEval(ro->buf, vars);
+            a = ruleEval(ro->arg, vars);
+            if ((int32_t)v != v || (bf_op_buf_t)b != b || (bf_off_t)a != a) return 0;   // operands don't fit
+            if ((bf_rules[r].flags & bf_RULE_WALK) && !a) return 0;
+        }
+        for (j = 0; j < 2 && (ro = bf_rules[r].ops + j)->cmd; j++, (*pc)++) {
+            _bfe_voba(bfo[*pc], ro->cmd, ruleEval(ro->val, vars), 0,
+                      ruleEval(ro->buf, vars), ruleEval(ro->arg, vars));
+        }
+        return (bf_rules[r].flags & bf_RULE_KEEP) ? 0 : n;
+    }
+    return 0;
+}
+
 // ----------------------------
 // Program optimization
 // ----------------------------
-int bf_Optimize(void** bfoptr, char* chars, int proglen, int printMetrics) {
-    bf_op* bfo = (bf_op*)malloc(sizeof(bf_op) * (size_t)(proglen + 1));
-    int lstack[bf_MEMDEFAULT];
-    int sstack[bf_MEMDEFAULT];
+int bf_Optimize(void** bfoptr, const char* chars, int proglen, int printMetrics) {
+    return bf_OptimizeEx(bfoptr, chars, proglen, printMetrics, 0);
+}
+
+int bf_OptimizeEx(void** bfoptr, const char* chars, int proglen, int printMetrics, const bf_OptOptions* opt) {
+    int record = opt && opt->profile && (opt->flags & bf_OPT_PROFILE);
+    int plain = opt && (opt->flags & bf_OPT_LANES);
+    bf_Profile* prof = (opt && !record) ? opt->profile : 0;
+    bf_Arena* ar = opt ? opt->arena : 0;
+    // recording adds two bfo_PROF per loop, at most doubling the op count;
+    // KEEP rules add at most two ops per (long) idiom
+    int cap = (record ? 2 : 1) * proglen + proglen / 8 + 1;
+    bf_op* bfo = (bf_op*)bf_Arena_alloc(ar, sizeof(bf_op) * (size_t)cap);
+    bf_optLoop* lstack = 0;
+    int lsize = 0;
 
     int pc = 0, rpc = 0;
     int cci = 0, sp = 0, c;
-    int loop = 0, l;
+    int loop = 0, l, lid = 0, hot, cold = 0;
     int off = 0, t1 = 0, tc;
+    int bad = -1, mark = 0;     // last op optimizeLoop can't take, first op not checked yet
+    unsigned char rfirst[256] = {0};
 
     if (!bfo) return -1;
     if (bfoptr) *bfoptr = 0;
 
+    if (prof && prof->hash != bf_hashProg(chars, proglen)) {
+        printf("// profile does not match program - ignored\n");
+        prof = 0;
+    }
+    // the counters sit in the loop bodies, so while recording optimizeLoop
+    // finds none it can rewrite; only the source-level rules still apply
+    if (record) {
+        for (c = tc = 0; c < proglen; c++) tc += (chars[c] == bf_OPEN);
+        _myfree(opt->profile->loops);
+        opt->profile->loops = (bf_loopProf*)calloc((size_t)tc + 1, sizeof(bf_loopProf));
+        opt->profile->loopCount = opt->profile->loops ? tc : 0;
+        opt->profile->hash = bf_hashProg(chars, proglen);
+        if (!opt->profile->loops) record = 0;
+    }
+    for (c = 0; c < bf_RULE_COUNT; c++) rfirst[(unsigned char)bf_rules[c].pat[0]] = 1;
+
     while (rpc < proglen) {
-        switch (c = (unsigned char)chars[rpc]) {
+        for (; mark < pc; mark++) if (!optimizeLoopOp(bfo[mark].cmd)) bad = mark;
+        c = (unsigned char)chars[rpc];
+        if (rfirst[c] && (tc = optimizeRules(bfo, &pc, chars, rpc, proglen, bf_loopHot(prof, lid), plain)) > 0) {
+            for (t1 = 0; t1 < tc; t1++) lid += (chars[rpc + t1] == bf_OPEN);
+            rpc += tc - 1;
+
+            // trailing +/- folds into a clear, trailing moves into the last op
+            rpc = valcounter(&cci, chars, rpc, proglen);
+            if (cci && bfo[pc - 1].cmd == bfo_VAL_ZERO) bfo[pc - 1].val += cci;
+            else if (cci) { _bfe_vo(bfo[pc], bfo_VAL, cci, 0); pc++; }
+            rpc = ptrcounter(&off, chars, rpc, proglen);
+            bfo[pc - 1].off = (bf_off_t)(bfo[pc - 1].off + off);
+            sp += off;
+            rpc++;
+            continue;
+        }
+
+        switch (c) {
         case bf_OPEN:
-            tc = ptrcounter(&t1, chars, rpc, proglen);
-            if (tc != rpc && (unsigned char)chars[tc + 1] == bf_CLOSE) {
-                rpc = tc + 1;
-                rpc = ptrcounter(&off, chars, rpc, proglen);
-                _bfe_vo(bfo[pc], bfo_PTR_S, t1, off);
-                sp += off;
+            if (record) {   // entry counter
+                _bfe_vob(bfo[pc], bfo_PROF, lid, 0, 0);
                 pc++;
-                break;
             }
 
-            sstack[loop] = sp;
+            _myaresize(ar, lstack, lsize, loop + 1);
+            lstack[loop].sp  = sp;
+            lstack[loop].id  = lid++;
+            lstack[loop].bad = bad;
+            lstack[loop++].l = pc;
             sp = 0;
-            lstack[loop++] = pc;
 
             rpc = valcounter(&cci, chars, rpc, proglen);
             rpc = ptrcounter(&off, chars, rpc, proglen);
             _bfe_vob(bfo[pc], bfo_FWD, pc, off, cci);
             sp += off;
             pc++;
+
+            if (record) {   // iteration counter
+                _bfe_vob(bfo[pc], bfo_PROF, lstack[loop - 1].id, 0, 1);
+                pc++;
+            }
             break;
 
         case bf_CLOSE:
             if (loop <= 0) goto OPT_ERROR;
 
-            l = lstack[--loop];
-            sp = sstack[loop];
+            l = lstack[--loop].l;
+            sp = lstack[loop].sp;
 
             rpc = valcounter(&cci, chars, rpc, proglen);
             rpc = ptrcounter(&off, chars, rpc, proglen);
@@ -264,8 +704,14 @@ int bf_Optimize(void** bfoptr, char* chars, int proglen, int printMetrics) {
             sp += off;
             pc++;
 
-            tc = optimizeLoop(bfo, l);
-            if (tc > 0) pc = tc;
+            // closed-form solving only pays off on hot loops
+            hot = bf_loopHot(prof, lstack[loop].id);
+            if (!hot) cold++;
+
+            // only bodies of plain ops are worth a scan; a rewritten loop
+            // forgets its ops and has its output checked for the outer ones
+            tc = (bad <= l) ? optimizeLoop(ar, bfo, l, hot) : -1;
+            if (tc > 0) { pc = tc; bad = lstack[loop].bad; mark = l; }
             break;
 
         case bf_GT:
@@ -308,21 +754,32 @@ int bf_Optimize(void** bfoptr, char* chars, int proglen, int printMetrics) {
         rpc++;
     }
 
+    bf_Arena_release(ar, lstack, sizeof(*lstack) * (size_t)lsize);
+    if (!plain) {
+        pc = optimizeBulk(ar, &bfo, cap, pc);
+        if (pc < 0) return -1;
+#if !BF_NGRAMS
+        optimizeSuper(bfo, pc);
+#endif
+    }
+
     if (printMetrics) {
         printf("//-- Optimization: Instructions [%d -> %d] using Bytes [%d -> %d] (op=%d bytes)\n",
                proglen, pc, proglen, (int)(pc * (int)sizeof(bf_op)), (int)sizeof(bf_op));
+        if (prof) printf("//-- Profile: %d of %d loops cold\n", cold, lid);
     }
 
     _bfe_vo(bfo[pc], bfo_EOP, 0, 0);
 
     if (bfoptr) *(bf_op**)bfoptr = bfo;
-    else free(bfo);
+    else bf_Arena_release(ar, bfo, sizeof(bf_op) * (size_t)cap);
 
     return pc;
 
 OPT_ERROR:
     printf("OPT_ERROR --- unbalanced '['\n");
-    free(bfo);
+    bf_Arena_release(ar, lstack, sizeof(*lstack) * (size_t)lsize);
+    bf_Arena_release(ar, bfo, sizeof(bf_op) * (size_t)cap);
     return -1;
 }
 
@@ -0,0 +1,19 @@
+// bffsree-super.h - generated by `make super` from op n-gram counts, do not edit
+// BF_SUPER2(a, za, b) / BF_SUPER3(a, za, b, zb, c): ops fused into one dispatch,
+// most dispatches saved first; z = 1 when that op's off is zero (no step after it).
+BF_SUPER2(VAL_MZ, 0, REW)    // 184691232
+BF_SUPER3(VAL_MZ, 0, VAL_MUL, 1, VAL_MZ)    // 76694974
+BF_SUPER3(VAL_MZ, 1, VAL, 0, REW)    // 61908552
+BF_SUPER3(VAL_MUL, 1, VAL_MZ, 1, VAL)    // 61896992
+BF_SUPER2(VAL_MUL, 1, VAL_MZ)    // 54634957
+BF_SUPER2(VAL, 0, REW)    // 50287021
+BF_SUPER2(VAL_MZ, 0, VAL_MUL)    // 38545631
+BF_SUPER3(VAL_MZ, 0, VAL, 0, REW)    // 38288306
+BF_SUPER2(VAL_MZ, 1, VAL)    // 33579949
+BF_SUPER3(VAL_MZ, 0, VAL_MZ, 0, REW)    // 32063532
+BF_SUPER3(VAL, 0, VAL_MUL, 1, VAL_MZ)    // 28583254
+BF_SUPER3(VAL_MUL, 1, VAL_MZ, 0, VAL_MZ)    // 27941906
+BF_SUPER3(VAL, 0, VAL_MZ, 0, FWD)    // 23519986
+BF_SUPER2(VAL_MZ, 0, VAL)    // 19250935
+BF_SUPER3(VAL_ZERO, 0, VAL, 0, FWD)    // 19230016
+BF_SUPER3(VAL_MUL, 1, VAL_MZ, 0, REW)    // 18922380
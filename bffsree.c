@@ -10,39 +10,407 @@
 #define _refInterp 0
 #endif
 
+#if !_refInterp
+// =====================================================================
+// bulk memory kernels (callers have bounds-checked the range)
+// =====================================================================
+static void bf_memset(bf_cell* tp, bf_cell v, int n) {
+#if BF_CELL_BITS == 8
+    memset(tp, v, (size_t)n);
+#else
+    while (n--) *tp++ = v;
+#endif
+}
+
+// tp[i] = (tp[i] & mask[i]) + add[i]; add follows mask in the constant pool
+static void bf_memvec(bf_cell* BF_RESTRICT tp, const bf_cell* BF_RESTRICT mask, int n) {
+    const bf_cell* BF_RESTRICT add = mask + n;
+    int i;
+    for (i = 0; i < n; i++) tp[i] = (bf_cell)((tp[i] & mask[i]) + add[i]);
+}
+
+// tp[i] += k[i] * s; s is read before the loop, so tp may cover its cell
+static void bf_mulvec(bf_cell* tp, bf_cell s, const bf_cell* BF_RESTRICT k, int n) {
+    int i;
+    for (i = 0; i < n; i++) tp[i] += (bf_cell)(k[i] * s);
+}
+
+// tp[i*dir + k] += m * tp[i*dir]; tp[i*dir] = 0 -- in walk order
+static void bf_memmove(bf_cell* tp, int k, int m, int n) {
+    int i, dir = (n < 0) ? -1 : 1;
+    n = _myabs(n);
+    if (_myabs(k) >= n) {   // disjoint: no carried values, vectorizes
+        bf_cell* BF_RESTRICT src = (dir < 0) ? tp - n + 1 : tp;
+        bf_cell* BF_RESTRICT dst = src + k;
+        for (i = 0; i < n; i++) { dst[i] += (bf_cell)(m * src[i]); src[i] = 0; }
+        return;
+    }
+    for (i = 0; i < n; i++, tp += dir) { tp[k] += (bf_cell)(m * tp[0]); tp[0] = 0; }
+}
+
+// first zero cell walking by stride; -1 if the walk leaves the tape
+static int bf_walkend(bf_cell* ptr, int sp, int len, int stride) {
+#if BF_CELL_BITS == 8
+    if (stride == 1) {
+        bf_cell* tp = (bf_cell*)memchr(ptr + sp, 0, (size_t)(len - sp));
+        return tp ? (int)(tp - ptr) : -1;
+    }
+#endif
+    while (ptr[sp]) {
+        sp += stride;
+        if (_mybounds(sp, len)) return -1;
+    }
+    return sp;
+}
+
+// clears cells walking by stride until a zero one; -1 if the walk leaves the tape
+static int bf_zerowalk(bf_cell* ptr, int sp, int len, int stride) {
+    int end = bf_walkend(ptr, sp, len, stride);
+    if (end < 0) return -1;
+    if (stride == 1) bf_memset(ptr + sp, 0, end - sp);
+    else for (; sp != end; sp += stride) ptr[sp] = 0;
+    return end;
+}
+
+// ptr[sp + k] += v walking by stride until a zero cell; -1 if the walk or
+// an add leaves the tape
+static int bf_addwalk(bf_cell* ptr, int sp, int len, bf_cell v, int k, int stride) {
+    int end, i, n;
+    bf_cell* tp;
+    if (k % stride == 0 && k / stride > 0) {   // adds land on cells still to be tested
+        while (ptr[sp]) {
+            if (_mybounds(sp + k, len)) return -1;
+            ptr[sp + k] += v;
+            sp += stride;
+            if (_mybounds(sp, len)) return -1;
+        }
+        return sp;
+    }
+    // otherwise find the end first, then add over the walked cells
+    if ((end = bf_walkend(ptr, sp, len, stride)) < 0) return -1;
+    n  = (end - sp) / stride;
+    if (n > 0 && (_mybounds(sp + k, len) || _mybounds(sp + k + (n - 1) * stride, len))) return -1;
+    tp = ptr + sp + k;
+    if (stride == 1) for (i = 0; i < n; i++) tp[i] += v;
+    else             for (i = 0; i < n; i++) tp[i * stride] += v;
+    return end;
+}
+
+// n at tp[0], d at tp[dd]; r, q follow d (stride dir) and two scratch cells
+// after q must be clear. Declines (the divmod loop then runs) when the
+// loop's result would not be the closed form. Only emitted where cells
+// wrap as unsigned (BF_CELL_MOD_POW2): / and % on signed cells differ.
+static void bf_divmod(bf_cell* tp, int dd, int dir, int copy) {
+    bf_cell n = tp[0], *t = tp + dd, d = t[0];
+    if (n == 0 || d < 2 || t[dir] || t[3 * dir] || t[4 * dir]) return;
+    t[2 * dir] += (bf_cell)(n / d);
+    t[dir]      = (bf_cell)(n % d);
+    t[0]        = (bf_cell)(d - t[dir]);
+    if (copy) tp[copy] += n;
+    tp[0] = 0;
+}
+#endif
+
+// =====================================================================
+// op names (dumps, n-gram counts and the superinstruction generator)
+// =====================================================================
+static const char* bf_opNames[bfo_Total] = {
+    "NOOP", "VAL", "PUT", "GET", "FWD", "REW",
+    "PTR_S", "MUL_MUL", "VAL_MZ", "VAL_MUL", "VAL_ZERO", "PROF",
+    "MEM_SET", "MEM_MOVE", "ZERO_S", "MOVE_S", "DIVMOD", "VAL_IF", "ADD_S", "MEM_VEC", "MUL_VEC",
+#define BF_SUPER2(a, za, b)         "S2_" #a "_" #za "_" #b,
+#define BF_SUPER3(a, za, b, zb, c)  "S3_" #a "_" #za "_" #b "_" #zb "_" #c,
+#include "bffsree-super.h"
+#undef BF_SUPER2
+#undef BF_SUPER3
+    "DEBUG", "EOP"
+};
+
+const char* bf_opName(int cmd) {
+    return (cmd >= 0 && cmd < bfo_Total) ? bf_opNames[cmd] : "???";
+}
+
+#if BF_NGRAMS
+// =====================================================================
+// op n-gram counts (instrumented build, see `make super`)
+// =====================================================================
+// key = cmd * 2 + (off == 0): a zero off lets the generator drop the step
+#define BF_NGRAM_KEYS (2 * bfo_Total)
+static uint64_t bf_ngram2[BF_NGRAM_KEYS][BF_NGRAM_KEYS];
+static uint64_t bf_ngram3[BF_NGRAM_KEYS][BF_NGRAM_KEYS][BF_NGRAM_KEYS];
+
+// counts ops executed back to back in IR order; a taken jump starts over
+static void bf_ngramCount(const bf_op* o) {
+    static const bf_op* last;
+    static int k1 = -1, k2 = -1;
+    int k = o->cmd * 2 + (o->off == 0);
+    if (o != last + 1) k1 = k2 = -1;
+    if (k1 >= 0) bf_ngram2[k1][k]++;
+    if (k2 >= 0) bf_ngram3[k2][k1][k]++;
+    k2 = k1; k1 = k; last = o;
+}
+
+static int bf_ngramKey(const char* name, int z) {
+    int i;
+    for (i = 0; i < bfo_Total; i++)
+        if (strcmp(bf_opNames[i], name) == 0) return i * 2 + (z != 0);
+    return -1;
+}
+
+// "<count> <op> <z> <op> [<z> <op>]" per line; existing counts are merged
+static int bf_ngramLoad(const char* path) {
+    FILE* fh = fopen(path, "r");
+    char line[256], a[32], b[32], c[32];
+    unsigned long long n;
+    int za, zb, ka, kb, kc, f;
+
+    if (!fh) return -1;
+    while (fgets(line, sizeof(line), fh)) {
+        f = sscanf(line, "%llu %31s %d %31s %d %31s", &n, a, &za, b, &zb, c);
+        if (f < 4) continue;
+        ka = bf_ngramKey(a, za);
+        kb = bf_ngramKey(b, f == 6 ? zb : 0);
+        if (ka < 0 || kb < 0) continue;
+        if (f == 6) {
+            if ((kc = bf_ngramKey(c, 0)) >= 0) bf_ngram3[ka][kb][kc] += n;
+        } else {
+            bf_ngram2[ka][kb] += n;
+        }
+    }
+    fclose(fh);
+    return 0;
+}
+
+static int bf_ngramSave(const char* path) {
+    FILE* fh;
+    uint64_t n;
+    int a, b, c;
+
+    bf_ngramLoad(path);
+    if (!(fh = fopen(path, "w"))) return -1;
+    // the last op's off doesn't matter to a superinstruction: fold it
+    for (a = 0; a < BF_NGRAM_KEYS; a++)
+        for (b = 0; b < BF_NGRAM_KEYS; b++) {
+            if (!(b & 1) && (n = bf_ngram2[a][b] + bf_ngram2[a][b + 1]))
+                fprintf(fh, "%llu %s %d %s\n", (unsigned long long)n,
+                        bf_opNames[a / 2], a & 1, bf_opNames[b / 2]);
+            for (c = 0; c < BF_NGRAM_KEYS; c += 2)
+                if ((n = bf_ngram3[a][b][c] + bf_ngram3[a][b][c + 1]))
+                    fprintf(fh, "%llu %s %d %s %d %s\n", (unsigned long long)n,
+                            bf_opNames[a / 2], a & 1, bf_opNames[b / 2], b & 1, bf_opNames[c / 2]);
+        }
+    fclose(fh);
+    return 0;
+}
+
+// ops a superinstruction can fuse; FWD/REW jump, so only as the last op
+static int bf_superOk(int cmd, int last) {
+    switch (cmd) {
+    case bfo_NOOP:    case bfo_VAL:     case bfo_PUT:     case bfo_PTR_S:  case bfo_VAL_MZ:
+    case bfo_VAL_MUL: case bfo_VAL_ZERO: case bfo_MUL_MUL: case bfo_VAL_IF: return 1;
+    case bfo_FWD:     case bfo_REW:     return last;
+    default:          return 0;
+    }
+}
+
+// writes bffsree-super.h: the BF_SUPER_MAX sequences saving the most dispatches
+static int bf_ngramGenSuper(const char* path, FILE* out) {
+    uint64_t best[BF_SUPER_MAX + 1], n;
+    int bk[BF_SUPER_MAX + 1][3], nb = 0, a, b, c, j, len;
+
+    if (bf_ngramLoad(path) != 0) return -1;
+    for (a = 0; a < BF_NGRAM_KEYS; a++) {
+        if (!bf_superOk(a / 2, 0)) continue;
+        for (b = 0; b < BF_NGRAM_KEYS; b++) {
+            for (c = -1; c < BF_NGRAM_KEYS; c += (c < 0) ? 1 : 2) {
+                len = (c < 0) ? 2 : 3;
+                if (len == 2 && (b & 1)) continue;
+                if (!bf_superOk(b / 2, len == 2) || (len == 3 && !bf_superOk(c / 2, 1))) continue;
+                n = (len == 2) ? bf_ngram2[a][b] : bf_ngram3[a][b][c];
+                n *= (uint64_t)(len - 1);   // dispatches saved
+                if (!n) continue;
+                // insert, keeping best[] sorted and at most BF_SUPER_MAX long
+                for (j = nb; j > 0 && best[j - 1] < n; j--) {
+                    best[j] = best[j - 1];
+                    memcpy(bk[j], bk[j - 1], sizeof(bk[j]));
+                }
+                best[j] = n; bk[j][0] = a; bk[j][1] = b; bk[j][2] = c;
+                if (nb < BF_SUPER_MAX) nb++;
+            }
+        }
+    }
+
+    fprintf(out, "// bffsree-super.h - generated by `make super` from op n-gram counts, do not edit\n");
+    fprintf(out, "// BF_SUPER2(a, za, b) / BF_SUPER3(a, za, b, zb, c): ops fused into one dispatch,\n");
+    fprintf(out, "// most dispatches saved first; z = 1 when that op's off is zero (no step after it).\n");
+    for (j = 0; j < nb; j++) {
+        a = bk[j][0]; b = bk[j][1]; c = bk[j][2];
+        if (c < 0) fprintf(out, "BF_SUPER2(%s, %d, %s)", bf_opNames[a / 2], a & 1, bf_opNames[b / 2]);
+        else       fprintf(out, "BF_SUPER3(%s, %d, %s, %d, %s)", bf_opNames[a / 2], a & 1,
+                           bf_opNames[b / 2], b & 1, bf_opNames[c / 2]);
+        fprintf(out, "    // %llu\n", (unsigned long long)best[j]);
+    }
+    return 0;
+}
+#endif
+
+// =====================================================================
+// op bodies shared by the VM switch and the superinstruction handlers
+// =====================================================================
+// Eval works on the window of cells touched so far: ptr/ptrLen cover
+// tape[wlo ..] and sp is relative to it, so the per-op check stays one
+// unsigned compare. An op that finds a cell it needs outside the window
+// jumps to WIDEN before it has changed anything (or when running it again
+// from there is a no-op, as for a walk that ended on a zero cell); WIDEN
+// grows the window if the cell is on the tape of tapeLen cells and
+// dispatches the op again.
+#define _bfx_touch(x)   if (_mybounds(x, ptrLen)) { wt = (x); goto WIDEN; }
+#define _bfx_bounds     _bfx_touch(sp)
+// the same, growing the window in place (left: rebase ptr and sp)
+#define _bfx_widen(x)   if (_mybounds(x, ptrLen)) { \
+                            wt = (x); \
+                            if (_mybounds(wt + wlo, tapeLen)) goto ERROR_BF; \
+                            if (wt < 0) { ptr += wt; sp -= wt; ptrLen -= wt; wlo += wt; } \
+                            else        ptrLen = wt + 1; \
+                        }
+
+#define _bfx_NOOP
+#define _bfx_VAL        ptr[sp] += (bf_cell)bfo->val;
+// a '.' with no room left or a ',' with no input yet stops on itself (SUSPEND)
+#define _bfx_PUT        if (vm->outLen == BF_OUTBUF && bf_VM_flush(vm) == BF_OUTBUF) { st = bf_EVAL_OUTPUT; goto SUSPEND; } \
+                        vm->out[vm->outLen++] = (char)ptr[sp];
+#define _bfx_GET        if (vm->inPos < vm->inEnd)              ptr[sp] = (bf_cell)(unsigned char)*vm->inPos++; \
+                        else if ((c = bf_VM_read(vm)) != BF_AGAIN) ptr[sp] = (bf_cell)c; \
+                        else { st = bf_EVAL_INPUT; goto SUSPEND; }
+#define _bfx_FWD        if (ptr[sp] == 0) bfo += bfo->val; \
+                        ptr[sp] += (bf_cell)bfo->buf;
+#define _bfx_REW        if (ptr[sp] != 0) { bfo += bfo->val; _bfx_HOT } \
+                        ptr[sp] += (bf_cell)bfo->buf;
+#define _bfx_PTR_S      wt = bf_walkend(ptr - wlo, sp + wlo, tapeLen, bfo->val); \
+                        if (wt < 0) goto ERROR_BF; \
+                        sp = wt - wlo; _bfx_bounds
+#define _bfx_VAL_MZ     ptr[sp + bfo->buf] += (bf_cell)(bfo->val * ptr[sp]); \
+                        ptr[sp] = 0;
+#define _bfx_VAL_MUL    ptr[sp + bfo->buf] += (bf_cell)(bfo->val * ptr[sp]);
+#define _bfx_VAL_ZERO   ptr[sp] = (bf_cell)bfo->val;
+#define _bfx_MUL_MUL    ptr[sp + bfo->buf] *= (bf_cell)(bfo->val * ptr[sp]);
+#define _bfx_VAL_IF     if (ptr[sp]) { ptr[sp + bfo->buf] += (bf_cell)bfo->val; ptr[sp] = 0; }
+#define _bfx_MEM_SET    c = bfo->arg; \
+                        _bfx_touch(sp + c - (c < 0 ? -1 : 1)) \
+                        tp = ptr + sp; if (c < 0) { c = -c; tp -= c - 1; } \
+                        bf_memset(tp, (bf_cell)bfo->val, c);
+#define _bfx_MEM_MOVE   _bfx_touch(sp + bfo->arg - (bfo->arg < 0 ? -1 : 1)) \
+                        bf_memmove(ptr + sp, bfo->buf, bfo->val, bfo->arg);
+#define _bfx_MEM_VEC    c = bfo->arg; \
+                        _bfx_touch(sp + bfo->buf) _bfx_touch(sp + bfo->buf + c - 1) \
+                        tp = ptr + sp + bfo->buf; \
+                        bf_memvec(tp, (const bf_cell*)(bfo + bfo->val), c);
+#define _bfx_MUL_VEC    c = bfo->arg; \
+                        _bfx_touch(sp + bfo->buf) _bfx_touch(sp + bfo->buf + c - 1) \
+                        tp = ptr + sp + bfo->buf; \
+                        bf_mulvec(tp, ptr[sp], (const bf_cell*)(bfo + bfo->val), c);
+#define _bfx_ZERO_S     wt = bf_zerowalk(ptr - wlo, sp + wlo, tapeLen, bfo->val); \
+                        if (wt < 0) goto ERROR_BF; \
+                        sp = wt - wlo; _bfx_bounds
+#define _bfx_ADD_S      wt = bf_addwalk(ptr - wlo, sp + wlo, tapeLen, (bf_cell)bfo->val, bfo->buf, bfo->arg); \
+                        if (wt < 0) goto ERROR_BF; \
+                        sp = wt - wlo; _bfx_bounds
+#define _bfx_MOVE_S     while (ptr[sp]) { \
+                            ptr[sp + bfo->buf] += (bf_cell)(bfo->val * ptr[sp]); \
+                            ptr[sp] = 0; \
+                            sp += bfo->arg; \
+                            _bfx_bounds \
+                        }
+#define _bfx_DIVMOD     if (!_mybounds(sp + wlo + bfo->buf + 4 * bfo->val, tapeLen) && !_mybounds(sp + wlo + bfo->buf, tapeLen)) { \
+                            _bfx_touch(sp + bfo->buf) _bfx_touch(sp + bfo->buf + 4 * bfo->val) \
+                            bf_divmod(ptr + sp, bfo->buf, bfo->val, bfo->arg); \
+                        }
+
+// every op without control flow
+#define _bfx_CASES \
+        case bfo_PTR_S:     _bfx_PTR_S      break; \
+        case bfo_ZERO_S:    _bfx_ZERO_S     break; \
+        case bfo_ADD_S:     _bfx_ADD_S      break; \
+        case bfo_MOVE_S:    _bfx_MOVE_S     break; \
+        case bfo_NOOP:      _bfx_NOOP       break; \
+        case bfo_VAL:       _bfx_VAL        break; \
+        case bfo_PUT:       _bfx_PUT        break; \
+        case bfo_GET:       _bfx_GET        break; \
+        case bfo_VAL_MZ:    _bfx_VAL_MZ     break; \
+        case bfo_VAL_MUL:   _bfx_VAL_MUL    break; \
+        case bfo_VAL_ZERO:  _bfx_VAL_ZERO   break; \
+        case bfo_MUL_MUL:   _bfx_MUL_MUL    break; \
+        case bfo_VAL_IF:    _bfx_VAL_IF     break; \
+        case bfo_MEM_SET:   _bfx_MEM_SET    break; \
+        case bfo_MEM_MOVE:  _bfx_MEM_MOVE   break; \
+        case bfo_MEM_VEC:   _bfx_MEM_VEC    break; \
+        case bfo_MUL_VEC:   _bfx_MUL_VEC    break; \
+        case bfo_DIVMOD:    _bfx_DIVMOD     break;
+
+// step between fused ops; step1 when the op's off is known to be zero
+#define _bfx_step0      sp += bfo->off; bfo++; \
+                        _bfx_bounds
+#define _bfx_step1      bfo++;
+
+// taken back-edge (bfo is the loop's FWD): one iteration off the budget
+#define _bfx_HOT        if (--icount < 0) goto YIELD;
+
+// superinstruction heads, in enum order after bfo_MUL_VEC
+static const uint8_t bf_superHead[] = {
+#define BF_SUPER2(a, za, b)         bfo_##a,
+#define BF_SUPER3(a, za, b, zb, c)  bfo_##a,
+#include "bffsree-super.h"
+#undef BF_SUPER2
+#undef BF_SUPER3
+    bfo_NOOP
+};
+
 // =====================================================================
 // main VM loop for bfi
 // =====================================================================
-int bffsree_Eval(bf_VM* vm, char* inp, int ocount) {
+int bffsree_Eval(bf_VM* vm, char* inp, int icount) {
     bf_cell* ptr = vm->tape;
     bf_op* bfo   = (bf_op*)vm->prog_op;
-    int ptrLen = vm->tapeLen;
+    int ptrLen = vm->tapeLen, tapeLen;
 #if _refInterp
     char* chars  = vm->prog;
     bf_VM_help* ph = vm->progHelper;
 #endif
     int pc = vm->pc;
     int sp = vm->sp;
-    int c, icount = ocount;
+    int c;
+    int wlo, wt, rim, st = bf_EVAL_BUDGET;
     bf_cell* tp;
 
+    if (!vm->prog_op) return bf_EVAL_ERROR;
+    if (pc < 0) { bf_VM_flush(vm); return bf_EVAL_EOP; }  // ended: only output left to hand on
     if (ptr == 0) {
         if (ptrLen == 0) ptrLen = bf_MAXCELLS;
         ptr = (bf_cell*)malloc((size_t)ptrLen * sizeof(bf_cell));
         memset(ptr, 0, (size_t)ptrLen * sizeof(bf_cell));
     }
+    if (vm->touchHi < vm->touchLo) vm->touchLo = vm->touchHi = sp;
+    // an op writes up to vm->reach cells from sp, so on a reserved tape sp
+    // stays that far in from both ends: tapeLen and wlo count from tape[rim]
+    rim     = vm->tapeMapped && !_refInterp ? _mymin(vm->reach, ptrLen / 2) : 0;
+    tapeLen = ptrLen - 2 * rim;
+    wlo     = vm->touchLo - rim;
+    ptrLen  = vm->touchHi - vm->touchLo + 1;
+    ptr    += vm->touchLo;
+    sp     -= vm->touchLo;
+    if (inp && !vm->inPos) bf_VM_input(vm, inp, strlen(inp));
 
 #if _refInterp
     do {
-        if (_mybounds(sp, ptrLen)) goto ERROR_BF;
+        _bfx_widen(sp)
         switch (c = chars[pc]) {
         default:        /*nothing*/                                         break;
         case bf_GT:     sp += ph[pc].v;                                     break;
         case bf_LT:     sp -= ph[pc].v;                                     break;
         case bf_PLUS:   ptr[sp] += (bf_cell)ph[pc].v;                       break;
         case bf_MINUS:  ptr[sp] -= (bf_cell)ph[pc].v;                       break;
-        case bf_PERIOD: vm->putcp(vm->putdata, ptr[sp]);                    break;
-        case bf_COMMA:  ptr[sp] = (inp && *inp) ? (bf_cell)*inp++ : (bf_cell)vm->getcp(vm->getdata); break;
+        case bf_PERIOD: _bfx_PUT                                            break;
+        case bf_COMMA:  _bfx_GET                                            break;
         case bf_OPEN:
             if (ptr[sp] != 0) break;
             else              pc = ph[pc].v;
@@ -54,181 +422,1982 @@ int bffsree_Eval(bf_VM* vm, char* inp, int ocount) {
         case bf_EOP:
         case 0:
             pc = -1;
+            st = bf_EVAL_EOP;
             goto DONE;
         }
         pc++;
     } while (icount--);
 
+SUSPEND:
 DONE:
     if (pc < 0) {
         vm->pc = -1;
-        if (ptr && vm->tape == 0) free(ptr);
+        if (ptr && vm->tape == 0) free(ptr - wlo);
     } else {
         vm->pc = pc;
-        vm->sp = sp;
+        vm->sp = sp + wlo + rim;
     }
 #else
     bfo += pc;
     do {
+TOP:
         c = bfo->cmd;
+#if BF_NGRAMS
+        bf_ngramCount(bfo);
+#endif
         switch (c) {
-        case bfo_NOOP:      /*nothing*/                                     break;
-        case bfo_VAL:       ptr[sp] += (bf_cell)bfo->val;                   break;
-        case bfo_PUT:       vm->putcp(vm->putdata, ptr[sp]);                break;
-        case bfo_GET:       ptr[sp] = (inp && *inp) ? (bf_cell)*inp++ : (bf_cell)vm->getcp(vm->getdata); break;
-        case bfo_FWD:       if (ptr[sp] == 0) bfo += bfo->val;
-                            ptr[sp] += (bf_cell)bfo->buf;
-                            break;
-        case bfo_REW:       if (ptr[sp] != 0) bfo += bfo->val;
-                            ptr[sp] += (bf_cell)bfo->buf;
-                            break;
-        case bfo_PTR_S:     c = bfo->val; tp = ptr + sp; while (*tp) tp += c; sp = (int)(tp - ptr);
-                            if (_mybounds(sp, ptrLen)) goto ERROR_BF;
-                            break;
-        case bfo_VAL_MZ:    ptr[sp + bfo->buf] += (bf_cell)(bfo->val * ptr[sp]);
-                            ptr[sp] = 0;
-                            break;
-        case bfo_VAL_MUL:   ptr[sp + bfo->buf] += (bf_cell)(bfo->val * ptr[sp]);
-                            break;
-        case bfo_VAL_ZERO:  ptr[sp] = (bf_cell)bfo->val;
-                            break;
-        case bfo_MUL_MUL:   ptr[sp + bfo->buf] *= (bf_cell)(bfo->val * ptr[sp]);
+        _bfx_CASES
+        case bfo_FWD:       _bfx_FWD                                        break;
+        case bfo_REW:       _bfx_REW                                        break;
+        case bfo_PROF:      if (bfo->buf) vm->profile->loops[bfo->val].iters++;
+                            else          vm->profile->loops[bfo->val].entries++;
                             break;
-        case bfo_EOP:       bfo = 0; goto DONE;
+        case bfo_EOP:       bfo = 0; st = bf_EVAL_EOP; goto DONE;
+
+        // fused superinstructions: the op bodies back to back, one dispatch
+#define BF_SUPER2(a, za, b) \
+        case bfo_S2_##a##_##za##_##b:             _bfx_##a _bfx_step##za _bfx_##b break;
+#define BF_SUPER3(a, za, b, zb, c) \
+        case bfo_S3_##a##_##za##_##b##_##zb##_##c: _bfx_##a _bfx_step##za _bfx_##b _bfx_step##zb _bfx_##c break;
+#include "bffsree-super.h"
+#undef BF_SUPER2
+#undef BF_SUPER3
         }
 
         sp += bfo->off;
         bfo++;
-        if (_mybounds(sp, ptrLen)) goto ERROR_BF;
+        _bfx_bounds
 #if !defined(NDEBUG)
         if (icount-- <= 0) goto DONE;
 #endif
     } while (1);
 
+WIDEN:
+    // cell wt is outside the window: widen it (or fault) and dispatch bfo
+    // again; inside a superinstruction bfo is the component op, which keeps
+    // its own cmd
+    if (_mybounds(wt + wlo, tapeLen)) goto ERROR_BF;
+    if (wt < 0) { ptr += wt; sp -= wt; ptrLen -= wt; wlo += wt; }
+    else        ptrLen = wt + 1;
+#if !defined(NDEBUG)
+    if (icount-- <= 0) goto DONE;   // the per-op charge the jump here skipped
+#else
+    if (icount < 0) goto DONE;
+#endif
+    goto TOP;
+
+YIELD:
+    // out of budget on a back-edge: finish it, stop at the body's first op
+    // (a fresh cell widens the window here rather than through WIDEN)
+    ptr[sp] += (bf_cell)bfo->buf;
+    sp += bfo->off;
+    bfo++;
+    if (_mybounds(sp + wlo, tapeLen)) goto ERROR_BF;
+    _bfx_widen(sp)
+    goto DONE;
+
+SUSPEND:    // bfo is a '.' or ',' that can't go on yet; it runs on the next call
 DONE:
     if (bfo == 0) {
         vm->pc = -1;
-        if (ptr && vm->tape == 0) free(ptr);
+        if (ptr && vm->tape == 0) free(ptr - wlo);
     } else {
         vm->pc = (int)(bfo - (bf_op*)vm->prog_op);
-        vm->sp = sp;
+        vm->sp = sp + wlo + rim;
     }
 #endif
-
-    return ocount - icount + 1;
+    vm->touchLo = wlo + rim;
+    vm->touchHi = wlo + rim + ptrLen - 1;
+    bf_VM_flush(vm);                // whatever stopped it, the sink gets the output
+    return st;
 
 ERROR_BF:
-    printf("// memory exception\n");
-    bfo = 0; pc = -1;
+    bf_VM_flush(vm);
+    bfo = 0; pc = -1; st = bf_EVAL_ERROR;
+    ptr -= wlo; wlo = 0; ptrLen = tapeLen;  // a bulk op may have written anywhere on its way out
     goto DONE;
 }
 
 // =====================================================================
-// bf_readfile - utility function
+// arena: one program's compile artifacts, freed together
 // =====================================================================
-static int bf_readfile(char** data, FILE* fh) {
-    int ci = 0, c, ps = bf_MEMDEFAULT - 1;
-    (*data) = (char*)malloc((size_t)ps + 1);
-    while ((c = getc(fh)) > 0) {
-        (*data)[ci++] = (char)c;
-        _myresize(*data, ps, ci + 1);
+#define _bf_arenaAlign(n)   (((n) + 15) & ~(size_t)15)
+#define _bf_arenaData(b)    ((char*)(b) + _bf_arenaAlign(sizeof(bf_ArenaBlock)))
+
+static bf_ArenaBlock* bf_Arena_block(bf_Arena* ar, size_t size) {
+    size_t n = _bf_arenaAlign(sizeof(bf_ArenaBlock)) + size;
+    bf_ArenaBlock* b = (ar->huge && size >= BF_HUGE_PAGE / 2) ? (bf_ArenaBlock*)bf_mapHuge(n, 0) : 0;
+    int mapped = b != 0;
+
+    if (!b && !(b = (bf_ArenaBlock*)malloc(n))) return 0;
+    b->size = size;
+    b->used = 0;
+    b->mapped = mapped;
+    ar->bytes += size;
+    ar->peak = _mymax(ar->peak, ar->bytes);
+    return b;
+}
+
+static void bf_Arena_drop(bf_Arena* ar, bf_ArenaBlock* b) {
+    ar->bytes -= b->size;
+#if !defined(_WIN32)
+    if (b->mapped) { munmap(b, _bf_arenaAlign(sizeof(bf_ArenaBlock)) + b->size); return; }
+#endif
+    free(b);
+}
+
+void* bf_Arena_alloc(bf_Arena* ar, size_t n) {
+    bf_ArenaBlock* b = ar ? ar->head : 0;
+    char* p;
+
+    if (!ar) return malloc(n);
+    n = _bf_arenaAlign(n);
+    if (!b || b->size - b->used < n) {
+        if (n > BF_ARENA_CHUNK / 4) {
+            // big: a block of its own behind the bump block, so it can grow in place
+            if (!(b = bf_Arena_block(ar, n))) return 0;
+            b->used = n;
+            if (ar->head) { b->next = ar->head->next; ar->head->next = b; }
+            else          { b->next = 0; ar->head = b; }
+            return _bf_arenaData(b);
+        }
+        if (!(b = bf_Arena_block(ar, BF_ARENA_CHUNK))) return 0;
+        b->next = ar->head;
+        ar->head = b;
+    }
+    p = _bf_arenaData(b) + b->used;
+    b->used += n;
+    return p;
+}
+
+void* bf_Arena_grow(bf_Arena* ar, void* p, size_t old, size_t n) {
+    bf_ArenaBlock *b, *nb, **link;
+    char* q;
+
+    if (!ar) return realloc(p, n);
+    if (!p) return bf_Arena_alloc(ar, n);
+    old = _bf_arenaAlign(old);
+    n   = _bf_arenaAlign(n);
+    if (n <= old) return p;
+    // the last bump allocation grows where it is
+    b = ar->head;
+    if ((char*)p + old == _bf_arenaData(b) + b->used && b->size - b->used >= n - old) {
+        b->used += n - old;
+        return p;
+    }
+    // a block of its own is realloc'd
+    for (link = &ar->head; (b = *link) != 0; link = &b->next) {
+        if (_bf_arenaData(b) != (char*)p || b->used != old) continue;
+        if (b->mapped || (ar->huge && n >= BF_HUGE_PAGE / 2)) {
+            // moves to (or between) huge page mappings
+            if (!(nb = bf_Arena_block(ar, n))) return 0;
+            memcpy(_bf_arenaData(nb), p, old);
+            nb->used = n;
+            nb->next = b->next;
+            *link = nb;
+            bf_Arena_drop(ar, b);
+            return _bf_arenaData(nb);
+        }
+        if (!(b = (bf_ArenaBlock*)realloc(b, _bf_arenaAlign(sizeof(bf_ArenaBlock)) + n))) return 0;
+        ar->bytes += n - b->size;
+        ar->peak = _mymax(ar->peak, ar->bytes);
+        b->size = b->used = n;
+        *link = b;
+        return _bf_arenaData(b);
+    }
+    if (!(q = (char*)bf_Arena_alloc(ar, n))) return 0;
+    memcpy(q, p, old);
+    return q;
+}
+
+// scratch of n bytes done with: the last bump allocation is taken back,
+// anything else waits for reset
+void bf_Arena_release(bf_Arena* ar, void* p, size_t n) {
+    bf_ArenaBlock* b;
+    if (!ar) { free(p); return; }
+    b = ar->head;
+    if (b && p && (char*)p + _bf_arenaAlign(n) == _bf_arenaData(b) + b->used) b->used -= _bf_arenaAlign(n);
+}
+
+void bf_Arena_reset(bf_Arena* ar) {
+    bf_ArenaBlock *b = ar->head, *keep = 0, *n;
+    for (; b; b = n) {
+        n = b->next;
+        if (!keep && b->size == BF_ARENA_CHUNK && !b->mapped) { keep = b; continue; }
+        bf_Arena_drop(ar, b);
+    }
+    if (keep) { keep->next = 0; keep->used = 0; }
+    ar->head = keep;
+}
+
+void bf_Arena_free(bf_Arena* ar) {
+    bf_Arena_reset(ar);
+    if (ar->head) bf_Arena_drop(ar, ar->head);
+    ar->head = 0;
+}
+
+// AnonHugePages of the /proc/self/smaps entry holding p
+long bf_hugeResident(const void* p) {
+#if defined(__linux__)
+    FILE* fh = fopen("/proc/self/smaps", "r");
+    char line[256];
+    unsigned long lo, hi, kb;
+    int in = 0;
+
+    if (!fh) return -1;
+    while (fgets(line, sizeof(line), fh)) {
+        if (sscanf(line, "%lx-%lx", &lo, &hi) == 2)
+            in = (unsigned long)p >= lo && (unsigned long)p < hi;
+        else if (in && sscanf(line, "AnonHugePages: %lu kB", &kb) == 1) {
+            fclose(fh);
+            return (long)kb * 1024;
+        }
     }
-    (*data)[ci++] = 0;
-    (*data) = (char*)realloc(*data, (size_t)ci);
-    return ci;
+    fclose(fh);
+#else
+    (void)p;
+#endif
+    return -1;
 }
 
 // =====================================================================
-// main
+// VM reuse: dirty-range reset and a per-thread pool
 // =====================================================================
-int bffsree_Main(int argc, char* argv[]) {
-    int carg = 1, proglen, printBF = 0, i;
-    int ci = 0, c, ps = 0, psh = 0, lc = 0, metric = 0;
-    char *prog = 0, *inp = 0;
-    unsigned char dc[256] = {0};
-    bf_VM_help* progHelp = 0;
-    bf_VM vm;
-    FILE* fh = 0;
+// cells an op can touch away from sp (the VM tracks where sp has been)
+static int bf_opReach(const bf_op* o) {
+    int c = o->cmd, b = _myabs(o->buf), a = _myabs(o->arg);
+    if (c > bfo_MUL_VEC && c < bfo_DEBUG) c = bf_superHead[c - bfo_MUL_VEC - 1];
+    switch (c) {
+    case bfo_VAL_MZ:  case bfo_VAL_MUL: case bfo_MUL_MUL:
+    case bfo_VAL_IF:  case bfo_ADD_S:   case bfo_MOVE_S:    return b;
+    case bfo_MEM_SET:                                       return a;
+    case bfo_MEM_MOVE: case bfo_MEM_VEC: case bfo_MUL_VEC:  return a + b;
+    case bfo_DIVMOD:                                        return b + 4 * _myabs(o->val);
+    default:                                                return 0;
+    }
+}
 
-    // options
-    for (i = 1; i < argc; i++) {
-        if (strcmp(argv[i], "-c") == 0)      { if (i == 1) carg++; printBF = 1; }
-        else if (strcmp(argv[i], "-j") == 0) { if (i == 1) carg++; printBF = 2; }
-        else if (strcmp(argv[i], "-m") == 0) { if (i == 1) carg++; metric = 1; }
+// zeroes cells lo..hi; big ranges of a reserved tape go back to the kernel
+static void bf_tapeClear(bf_VM* bp, int lo, int hi) {
+    char* p = (char*)(bp->tape + lo);
+    size_t n = (size_t)(hi - lo + 1) * sizeof(bf_cell);
+#if !defined(_WIN32) && defined(MADV_DONTNEED)
+    size_t page = 4096, a, e;
+    if (bp->tapeMapped && n >= 64 * page) {
+        a = ((size_t)p + page - 1) & ~(page - 1);
+        e = ((size_t)p + n) & ~(page - 1);
+        memset(p, 0, a - (size_t)p);
+        memset((char*)e, 0, (size_t)p + n - e);
+        if (madvise((void*)a, e - a, MADV_DONTNEED) == 0) return;
+        memset((char*)a, 0, e - a);
+        return;
+    }
+#endif
+    memset(p, 0, n);
+}
+
+int bf_VM_reset(bf_VM* bp) {
+    int lo = bp->touchLo, hi = bp->touchHi, r = bp->reach;
+
+    if (bp->tape && hi >= lo) {
+        bf_tapeClear(bp, _mymax(lo - r, 0), _mymin(hi + r, bp->tapeLen - 1));
     }
+    bf_VM_dropProg(bp);
+    bp->progLen = bp->progLen_op = bp->reach = 0;
+    bp->profile = 0;
+    bp->pc = 0;
+    bp->sp = bp->tapeOrigin;
+    bp->inPos = bp->inEnd = 0;
+    bp->outLen = 0;             // a suspended run's output is not the next owner's
+    bp->touchHi = bp->touchLo - 1;
+    return 0;
+}
 
-    if (argc > carg) {
-        fh = fopen(argv[carg], "r");
-        if (fh == 0) { printf("//unable to open file [%s]\n", argv[carg]); return -1; }
-    } else {
-        fh = stdin;
+static BF_THREAD_LOCAL bf_VM* bf_vmPool[BF_VM_POOL];
+static BF_THREAD_LOCAL int    bf_vmPooled;
+
+bf_VM* bf_VM_acquire(void) {
+    bf_VM* vm;
+    if (bf_vmPooled) return bf_vmPool[--bf_vmPooled];
+    if (!(vm = (bf_VM*)malloc(sizeof(bf_VM)))) return 0;
+    bf_VM_alloc(vm);
+    if (bf_VM_tapeReserve(vm, BF_TAPE_RESERVE, 0) != 0) { free(vm); return 0; }
+    return vm;
+}
+
+void bf_VM_release(bf_VM* vm) {
+    if (!vm) return;
+    bf_VM_reset(vm);
+    vm->getcp = bf_getc; vm->getdata = 0;
+    vm->putcp = bf_putc; vm->putdata = 0;
+    vm->writep = 0; vm->writedata = 0;
+    vm->readp  = 0; vm->readdata  = 0;
+    vm->arena = 0;
+    if (bf_vmPooled < BF_VM_POOL) { bf_vmPool[bf_vmPooled++] = vm; return; }
+    bf_VM_free(vm);
+    free(vm);
+}
+
+void bf_VM_poolDrain(void) {
+    while (bf_vmPooled) {
+        bf_VM_free(bf_vmPool[--bf_vmPooled]);
+        free(bf_vmPool[bf_vmPooled]);
+    }
+}
+
+// =====================================================================
+// file descriptor sinks: a full or empty non-blocking fd suspends the VM
+// =====================================================================
+#if defined(_WIN32)
+#define bf_sysread(fd, b, n)    _read(fd, b, (unsigned)(n))
+#define bf_syswrite(fd, b, n)   _write(fd, b, (unsigned)(n))
+#else
+#define bf_sysread              read
+#define bf_syswrite             write
+#endif
+
+int bf_readFd(void* fd, char* buf, size_t n) {
+    long r = (long)bf_sysread((int)(intptr_t)fd, buf, n);
+    if (r < 0) return (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR) ? BF_AGAIN : 0;
+    return (int)r;
+}
+
+int bf_writeFd(void* fd, const char* buf, size_t n) {
+    long r;
+    size_t k = 0;
+    while (k < n) {
+        r = (long)bf_syswrite((int)(intptr_t)fd, buf + k, n - k);
+        if (r < 0 && errno == EINTR) continue;
+        if (r < 0 && errno != EAGAIN && errno != EWOULDBLOCK) return (int)n;  // broken: dropped
+        if (r <= 0) break;  // full: the rest waits
+        k += (size_t)r;
+    }
+    return (int)k;
+}
+
+// =====================================================================
+// streams: double-buffered fd I/O, drained/filled by io_uring when it's there
+// =====================================================================
+#if BF_URING
+static int bf_uringEnter(int ring, unsigned submit, unsigned wait) {
+    return (int)syscall(__NR_io_uring_enter, ring, submit, wait, wait ? IORING_ENTER_GETEVENTS : 0, NULL, 0);
+}
+
+static void bf_uringFree(bf_Stream* s) {
+    if (s->sqes) munmap(s->sqes, 2 * sizeof(struct io_uring_sqe));
+    if (s->cq && s->cq != s->sq) munmap(s->cq, s->cqSize);
+    if (s->sq) munmap(s->sq, s->sqSize);
+    close(s->ring);
+    s->ring = -1;
+}
+
+// a two-entry ring: at most one buffer is in flight at a time, so offset -1
+// (the fd's own position) keeps writes and reads in order
+static int bf_uringSetup(bf_Stream* s) {
+    struct io_uring_params p;
+    char *sq, *cq;
+
+    memset(&p, 0, sizeof(p));
+    if ((s->ring = (int)syscall(__NR_io_uring_setup, 2, &p)) < 0) return -1;
+    if (!(p.features & IORING_FEAT_RW_CUR_POS)) { bf_uringFree(s); return -1; }
+    s->sqSize = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+    s->cqSize = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+    if (p.features & IORING_FEAT_SINGLE_MMAP) s->sqSize = s->cqSize = _mymax(s->sqSize, s->cqSize);
+
+    sq = (char*)mmap(0, s->sqSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, s->ring, IORING_OFF_SQ_RING);
+    if (sq == MAP_FAILED) { bf_uringFree(s); return -1; }
+    s->sq = sq;
+    cq = sq;
+    if (!(p.features & IORING_FEAT_SINGLE_MMAP)) {
+        cq = (char*)mmap(0, s->cqSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, s->ring, IORING_OFF_CQ_RING);
+        if (cq == MAP_FAILED) { bf_uringFree(s); return -1; }
+    }
+    s->cq = cq;
+    s->sqes = mmap(0, p.sq_entries * sizeof(struct io_uring_sqe), PROT_READ | PROT_WRITE,
+                   MAP_SHARED | MAP_POPULATE, s->ring, IORING_OFF_SQES);
+    if (s->sqes == MAP_FAILED) { s->sqes = 0; bf_uringFree(s); return -1; }
+
+    s->sqTail  = (unsigned*)(sq + p.sq_off.tail);
+    s->sqMask  = (unsigned*)(sq + p.sq_off.ring_mask);
+    s->sqArray = (unsigned*)(sq + p.sq_off.array);
+    s->cqHead  = (unsigned*)(cq + p.cq_off.head);
+    s->cqTail  = (unsigned*)(cq + p.cq_off.tail);
+    s->cqMask  = (unsigned*)(cq + p.cq_off.ring_mask);
+    s->cqes    = cq + p.cq_off.cqes;
+    return 0;
+}
+
+// queues buf[i]: len[i] bytes out, or a full buffer in
+static int bf_uringSubmit(bf_Stream* s, int i) {
+    unsigned tail = *s->sqTail, k = tail & *s->sqMask;
+    struct io_uring_sqe* e = (struct io_uring_sqe*)s->sqes + k;
+
+    memset(e, 0, sizeof(*e));
+    e->opcode = (uint8_t)(s->out ? IORING_OP_WRITE : IORING_OP_READ);
+    e->fd     = s->fd;
+    e->addr   = (uint64_t)(uintptr_t)s->buf[i];
+    e->len    = (unsigned)(s->out ? s->len[i] : BF_STREAM_BUF);
+    e->off    = (uint64_t)-1;
+    s->sqArray[k] = k;
+    __atomic_store_n(s->sqTail, tail + 1, __ATOMIC_RELEASE);
+    return bf_uringEnter(s->ring, 1, 0) == 1 ? 0 : -1;
+}
+
+// result of the one request in flight
+static int bf_uringWait(bf_Stream* s) {
+    unsigned head = *s->cqHead;
+    int r;
+    while (head == __atomic_load_n(s->cqTail, __ATOMIC_ACQUIRE))
+        if (bf_uringEnter(s->ring, 0, 1) < 0 && errno != EINTR) return -1;
+    r = ((struct io_uring_cqe*)s->cqes)[head & *s->cqMask].res;
+    __atomic_store_n(s->cqHead, head + 1, __ATOMIC_RELEASE);
+    return r;
+}
+#endif
+
+int bf_Stream_open(bf_Stream* s, int fd, int out) {
+    memset(s, 0, sizeof(*s));
+    s->fd   = fd;
+    s->out  = out;
+    s->ring = -1;
+    if (!(s->buf[0] = (char*)malloc(2 * (size_t)BF_STREAM_BUF))) return -1;
+    s->buf[1] = s->buf[0] + BF_STREAM_BUF;
+#if BF_URING
+    if (bf_uringSetup(s) == 0) return 0;
+#endif
+    return 1;
+}
+
+// out: the buffer in flight is done; a short write finishes in place
+static void bf_streamDrain(bf_Stream* s) {
+#if BF_URING
+    int i = s->cur ^ 1, r;
+    if (!s->busy) return;
+    s->busy = 0;
+    r = bf_uringWait(s);
+    if (r >= 0 && (size_t)r < s->len[i]) bf_writeFd((void*)(intptr_t)s->fd, s->buf[i] + r, s->len[i] - (size_t)r);
+    s->len[i] = 0;
+#else
+    (void)s;
+#endif
+}
+
+// out: hands buf[cur] on and moves to the other buffer once that one is free
+static void bf_streamSend(bf_Stream* s) {
+    bf_streamDrain(s);
+#if BF_URING
+    if (s->ring >= 0 && bf_uringSubmit(s, s->cur) == 0) { s->busy = 1; s->cur ^= 1; return; }
+#endif
+    bf_writeFd((void*)(intptr_t)s->fd, s->buf[s->cur], s->len[s->cur]);
+    s->len[s->cur] = 0;
+}
+
+int bf_Stream_write(void* data, const char* buf, size_t n) {
+    bf_Stream* s = (bf_Stream*)data;
+    size_t k, left = n;
+    while (left) {
+        k = _mymin(left, BF_STREAM_BUF - s->len[s->cur]);
+        memcpy(s->buf[s->cur] + s->len[s->cur], buf, k);
+        s->len[s->cur] += k;
+        buf  += k;
+        left -= k;
+        if (s->len[s->cur] == BF_STREAM_BUF) bf_streamSend(s);
+    }
+    return (int)n;
+}
+
+// in: the next buffer becomes current (empty at EOF); with io_uring it was
+// read ahead, and the one just used is sent off to read the one after
+static void bf_streamFill(bf_Stream* s) {
+    long r;
+#if BF_URING
+    if (s->ring >= 0 && !s->busy && bf_uringSubmit(s, s->cur ^ 1) == 0) s->busy = 1;
+    if (s->busy) {
+        r = bf_uringWait(s);
+        s->busy = 0;
+        s->cur ^= 1;
+        s->pos = 0;
+        s->len[s->cur] = r > 0 ? (size_t)r : 0;
+        if (r > 0 && bf_uringSubmit(s, s->cur ^ 1) == 0) s->busy = 1;
+        return;
+    }
+#endif
+    do {
+        r = (long)bf_sysread(s->fd, s->buf[s->cur], BF_STREAM_BUF);
+    } while (r < 0 && errno == EINTR);
+    s->pos = 0;
+    s->len[s->cur] = r > 0 ? (size_t)r : 0;
+}
+
+int bf_Stream_read(void* data, char* buf, size_t n) {
+    bf_Stream* s = (bf_Stream*)data;
+    size_t k;
+    if (s->pos == s->len[s->cur]) {
+        bf_streamFill(s);
+        if (s->len[s->cur] == 0) return 0;
+    }
+    k = _mymin(n, s->len[s->cur] - s->pos);
+    memcpy(buf, s->buf[s->cur] + s->pos, k);
+    s->pos += k;
+    return (int)k;
+}
+
+void bf_Stream_close(bf_Stream* s) {
+    if (s->out) {
+        bf_streamDrain(s);
+        if (s->len[s->cur]) bf_streamSend(s);
+        bf_streamDrain(s);
     }
+#if BF_URING
+    if (s->ring >= 0) bf_uringFree(s);     // a read still in flight is cancelled
+#endif
+    _myfree(s->buf[0]);
+    s->buf[1] = 0;
+}
+
+// =====================================================================
+// bf_readfile - utility function
+// =====================================================================
+static size_t bf_readfile(bf_Arena* ar, char** data, FILE* fh) {
+    size_t n = 0, cap = 0, r;
+    char* p = 0;
+
+    // the whole stream, NULs included, then a terminator
+    do {
+        _myaresize(ar, p, cap, n + BF_INBUF + 1);
+        if (!p) { *data = 0; return 0; }
+        r = fread(p + n, 1, cap - n - 1, fh);
+        n += r;
+    } while (r > 0);
+    p[n] = 0;
+    *data = p;
+    return n;
+}
+
+// the whole file mapped read-only, 0 if it can't be (not a regular file,
+// empty, no mmap) -- bf_readfile takes those; munmap(*data, n) releases it
+static size_t bf_mapfile(char** data, const char* path) {
+#if defined(_WIN32)
+    (void)path;
+    *data = 0;
+    return 0;
+#else
+    struct stat st;
+    int fd = open(path, O_RDONLY);
+    size_t n;
+    void* p;
+
+    *data = 0;
+    if (fd < 0) return 0;
+    if (fstat(fd, &st) != 0 || !S_ISREG(st.st_mode) || st.st_size <= 0) { close(fd); return 0; }
+    n = (size_t)st.st_size;
+    p = mmap(0, n, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (p == MAP_FAILED) return 0;
+    madvise(p, n, MADV_SEQUENTIAL);
+    *data = (char*)p;
+    return n;
+#endif
+}
+
+// =====================================================================
+// bf_VM_compile - source text to IR
+// =====================================================================
+// command chars of src up to its end, a NUL or the '!' input mark (*end is
+// where it stopped); copied to out unless that is 0. -1: unbalanced brackets
+static long bf_lex(const char* src, size_t len, char* out, size_t* end) {
+    unsigned char dc[256] = {0};
+    long n = 0, lc = 0;
+    size_t pos;
+    int c;
 
-    // read program
-    dc['>'] = bf_GT;     dc['<'] = bf_LT;    dc['+'] = bf_PLUS; dc['-'] = bf_MINUS;
-    dc['.'] = bf_PERIOD; dc[','] = bf_COMMA; dc['['] = bf_OPEN; dc[']'] = bf_CLOSE;
-    while ((c = getc(fh)) > 0) {
+    dc['>'] = dc['<'] = dc['+'] = dc['-'] = dc['.'] = dc[','] = dc['['] = dc[']'] = 1;
+    for (pos = 0; pos < len && (c = (unsigned char)src[pos]) != 0; pos++) {
         if (c == '!') break;  // input
-        if (c == '%' || c == ';')  // comment
-            do { c = getc(fh); } while (c > 0 && c != '\r' && c != '\n');
+        if (c == '%' || c == ';') {  // comment
+            while (pos + 1 < len && src[pos + 1] != '\r' && src[pos + 1] != '\n') pos++;
+            continue;
+        }
+        if (!dc[c]) continue;
+        if (c == bf_OPEN) lc++;
+        else if (c == bf_CLOSE && --lc < 0) break;
+        if (out) out[n] = (char)c;
+        n++;
+    }
+    *end = pos;
+    if (lc) { printf("// error - unbalanced braces\n"); return -1; }
+    return n;
+}
 
-        if ((c = dc[(unsigned char)c])) {
-            _myresize(prog, ps, ci + 2);      // next char, plus null terminator
-            _myresize(progHelp, psh, ci + 1);
+// lexes and optimizes src into p's program fields (what follows a '!' is
+// p's input, in place); IR and the reference build's source from opt's arena
+static int bf_compile(bf_Program* p, const char* src, size_t len, int printMetrics, const bf_OptOptions* opt) {
+    const char* chars = src;
+    char* copy = 0;
+    size_t end;
+    long n = bf_lex(src, len, 0, &end);
+    int i;
+
+    if (n < 0) return -1;
+    if (n > INT_MAX - 1) { printf("// error - program too large\n"); return -1; }
+    if ((size_t)n != end) {  // comments or other text: optimize a compacted copy
+        copy = (char*)malloc((size_t)n + 1);
+        if (!copy) return -1;
+        bf_lex(src, len, copy, &end);
+        chars = copy;
+    }
+    if (end < len && src[end] == '!') { p->input = src + end + 1; p->inputLen = len - end - 1; }
+
+#if _refInterp
+    {   // the reference loop runs the source, runs folded, brackets paired
+        bf_Arena* ar = opt ? opt->arena : 0;
+        int* opens = 0;
+        int ci = 0, lc = 0, ps = 0, psh = 0, pso = 0, c, i, o;
+
+        for (i = 0; i < (int)n; i++) {
+            c = (unsigned char)chars[i];
+            _myaresize(ar, p->prog, ps, ci + 2);       // next char, plus null terminator
+            _myaresize(ar, p->progHelper, psh, ci + 1);
             switch (c) {
-            case bf_CLOSE:
-                carg = ci;
-                while (--carg >= 0) {
-                    if (prog[carg] == bf_OPEN) {
-                        if (lc == 0) break; else lc--;
-                    } else if (prog[carg] == bf_CLOSE) lc++;
-                }
-                if (carg < 0) {
-                    printf("// error - unbalanced braces\n");
-                } else {
-                    progHelp[carg].v = ci;
-                    progHelp[ci].v   = carg;
-                }
+            case bf_OPEN:
+                _myaresize(ar, opens, pso, lc + 1);
+                opens[lc++] = ci;
                 break;
 
+            case bf_CLOSE:
+                o = opens[--lc];
+                p->progHelper[o].v  = ci;
+                p->progHelper[ci].v = o;
+                p->prog[ci++] = (char)c;
+                continue;
+
             case bf_LT:     case bf_GT:
             case bf_PLUS:   case bf_MINUS:
-                if (_refInterp && ci && prog[ci - 1] == c) { ci--; progHelp[ci].v++; }
-                else                                        { progHelp[ci].v = 1; }
-                break;
-
-            default:
-                progHelp[ci].v = 1;
+                if (ci && p->prog[ci - 1] == c) { p->progHelper[ci - 1].v++; continue; }
                 break;
             }
-            prog[ci++] = (char)c;
+            p->progHelper[ci].v = 1;
+            p->prog[ci++] = (char)c;
         }
+        _myaresize(ar, p->prog, ps, ci + 1);           // an empty program has none yet
+        p->prog[ci++] = 0;
+        p->progLen = ci;
+        bf_Arena_release(ar, opens, sizeof(int) * (size_t)pso);
+        chars = p->prog;
+        n = ci;
     }
-    prog[ci++] = 0;
-    proglen = ci;
-    prog = (char*)realloc(prog, (size_t)ci);
-    if (c == '!') bf_readfile(&inp, fh);
-    if (fh && fh != stdin) fclose(fh);
+#else
+    p->progLen = (int)n;
+#endif
 
-    // run
-    bf_VM_alloc(&vm);
-    bf_VM_tape(&vm, bf_MAXCELLS);
-    vm.prog       = prog;
-    vm.progLen    = proglen;
-    vm.progHelper = progHelp;
-    vm.progLen_op = bf_Optimize(&vm.prog_op, vm.prog, vm.progLen, metric);
-    if (printBF == 2)        bffsree_Print(&vm, inp, 0);
-    else if (printBF == 1)   bffsree_Print(&vm, inp, 1);
-    else {
-        do {
-            bffsree_Eval(&vm, inp, 10000);
-        } while (vm.pc > 0);
+    p->progLen_op = bf_OptimizeEx(&p->prog_op, chars, (int)n, printMetrics, opt);
+    for (i = 0; i < p->progLen_op; i++) p->reach = _mymax(p->reach, bf_opReach((const bf_op*)p->prog_op + i));
+    free(copy);
+    return p->progLen_op;
+}
+
+int bf_VM_compile(bf_VM* vm, const char* src, size_t len, int printMetrics, const bf_OptOptions* opt) {
+    bf_Program p;
+    int r;
+
+    memset(&p, 0, sizeof(p));
+    bf_VM_dropProg(vm);
+    vm->arena = opt ? opt->arena : 0;
+    r = bf_compile(&p, src, len, printMetrics, opt);
+    vm->prog       = p.prog;        // whatever got built, dropProg frees
+    vm->progLen    = p.progLen;
+    vm->progHelper = p.progHelper;
+    vm->prog_op    = p.prog_op;
+    vm->progLen_op = p.progLen_op;
+    vm->reach      = p.reach;
+    if (p.input && !vm->inPos) bf_VM_input(vm, p.input, p.inputLen);
+    return r;
+}
+
+// =====================================================================
+// bf_Program - one compile, shared by many VMs
+// =====================================================================
+bf_Program* bf_Program_compile(const char* src, size_t len, int printMetrics, const bf_OptOptions* opt) {
+    bf_Program* p = (bf_Program*)calloc(1, sizeof(bf_Program));
+    bf_OptOptions o = {0, 0, 0};
+    char* in = 0;
+
+    if (!p) return 0;
+    if (opt) o = *opt;
+    o.arena = &p->arena;
+    if (bf_compile(p, src, len, printMetrics, &o) < 0 ||
+        (p->inputLen && !(in = (char*)bf_Arena_alloc(&p->arena, p->inputLen)))) {
+        bf_Arena_free(&p->arena);
+        free(p);
+        return 0;
     }
-    bf_VM_free(&vm);
+    if (in) p->input = (const char*)memcpy(in, p->input, p->inputLen);
+    p->refs = 1;
+    return p;
+}
 
-    // done
-    if (inp) free(inp);
+bf_Program* bf_Program_retain(bf_Program* p) {
+    if (p) bf_atomicInc(&p->refs);
+    return p;
+}
+
+void bf_Program_release(bf_Program* p) {
+    if (!p || bf_atomicDec(&p->refs) > 0) return;
+    bf_Arena_free(&p->arena);
+    free(p);
+}
+
+int bf_VM_load(bf_VM* vm, bf_Program* p) {
+    bf_VM_dropProg(vm);
+    vm->arena      = 0;
+    vm->program    = bf_Program_retain(p);
+    vm->prog       = p->prog;
+    vm->progLen    = p->progLen;
+    vm->progHelper = p->progHelper;
+    vm->prog_op    = p->prog_op;
+    vm->progLen_op = p->progLen_op;
+    vm->reach      = p->reach;
+    if (p->input && !vm->inPos) bf_VM_input(vm, p->input, p->inputLen);
     return 0;
 }
 
+// =====================================================================
+// lanes: one program in lockstep over many inputs
+// =====================================================================
+#define _bfl_at(x, l)   ((size_t)(x) * (size_t)n + (size_t)(l))
+
+int bf_Lanes_init(bf_Lanes* ln, bf_Program* p, int n, int cells) {
+    const bf_op* o = (const bf_op*)p->prog_op;
+    int i;
+
+    memset(ln, 0, sizeof(*ln));
+    for (i = 0; o && i < p->progLen_op; i++)   // the per-cell ops of bf_OPT_LANES
+        if (o[i].cmd > bfo_VAL_IF || o[i].cmd == bfo_PROF || o[i].cmd == bfo_MEM_SET ||
+            (o[i].cmd >= bfo_MEM_MOVE && o[i].cmd <= bfo_DIVMOD)) return -1;
+    if (!o || n < 1 || cells < 1) return -1;
+    ln->n = n;
+    ln->cells = cells;
+    ln->tape = (bf_cell*)calloc((size_t)n * (size_t)cells, sizeof(bf_cell));
+    ln->sp   = (int*)malloc(sizeof(int) * (size_t)n);
+    ln->on   = (uint8_t*)malloc((size_t)n);
+    ln->lane = (bf_Lane*)calloc((size_t)n, sizeof(bf_Lane));
+    if (!ln->tape || !ln->sp || !ln->on || !ln->lane) { bf_Lanes_free(ln); return -1; }
+    memset(ln->on, 1, (size_t)n);
+    for (i = 0; i < n; i++) ln->lane[i].st = bf_EVAL_BUDGET;
+    ln->uni = 1;
+    ln->usp = cells / 2;
+    ln->program = bf_Program_retain(p);
+    return 0;
+}
+
+void bf_Lanes_input(bf_Lanes* ln, int lane, const char* in, size_t len) {
+    ln->lane[lane].inPos = in;
+    ln->lane[lane].inEnd = in + len;
+}
+
+void bf_Lanes_free(bf_Lanes* ln) {
+    int i;
+    for (i = 0; ln->lane && i < ln->n; i++) _myfree(ln->lane[i].out);
+    _myfree(ln->lane);
+    _myfree(ln->tape);
+    _myfree(ln->sp);
+    _myfree(ln->on);
+    _myfree(ln->masks);
+    _myfree(ln->full);
+    bf_Program_release(ln->program);
+    ln->program = 0;
+}
+
+static void bf_lanePut(bf_Lane* a, bf_cell c) {
+    _myaresize(0, a->out, a->outCap, a->outLen + 1);
+    if (!a->out) { a->outLen = a->outCap = 0; return; }    // out of memory: dropped
+    a->out[a->outLen++] = (char)c;
+}
+
+static bf_cell bf_laneGet(bf_Lane* a) {
+    return (bf_cell)(a->inPos < a->inEnd ? (unsigned char)*a->inPos++ : EOF);
+}
+
+// memory exception: the lane stops, and no loop exit brings it back
+static void bf_laneFail(bf_Lanes* ln, int l) {
+    int d;
+    ln->lane[l].st = bf_EVAL_ERROR;
+    ln->on[l] = 0;
+    for (d = 0; d < ln->depth; d++) {
+        if (ln->full[d]) { memset(ln->masks + (size_t)d * ln->n, 1, (size_t)ln->n); ln->full[d] = 0; }
+        ln->masks[(size_t)d * ln->n + l] = 0;
+    }
+}
+
+// a loop is entered: remember who by (all lanes: just a flag)
+static int bf_lanesPush(bf_Lanes* ln, int all) {
+    if (ln->depth == ln->maxDepth) {
+        _myaresize(0, ln->full, ln->maxDepth, ln->depth + 1);
+        ln->masks = (uint8_t*)realloc(ln->masks, (size_t)ln->maxDepth * (size_t)ln->n);
+        if (!ln->full || !ln->masks) return -1;
+    }
+    ln->full[ln->depth] = (uint8_t)all;
+    if (!all) memcpy(ln->masks + (size_t)ln->depth * ln->n, ln->on, (size_t)ln->n);
+    ln->depth++;
+    return 0;
+}
+
+// lanes that all run and stand on the same cell go on together again
+static void bf_lanesJoin(bf_Lanes* ln) {
+    int l;
+    for (l = 0; l < ln->n && ln->on[l] && ln->sp[l] == ln->sp[0]; l++);
+    if (l == ln->n) { ln->uni = 1; ln->usp = ln->sp[0]; }
+}
+
+// every lane left the loop: the ones that entered it go on
+static void bf_lanesPop(bf_Lanes* ln) {
+    ln->depth--;
+    if (ln->full[ln->depth]) memset(ln->on, 1, (size_t)ln->n);
+    else memcpy(ln->on, ln->masks + (size_t)ln->depth * ln->n, (size_t)ln->n);
+    bf_lanesJoin(ln);
+}
+
+// lanes go their own way from here
+static void bf_lanesSplit(bf_Lanes* ln) {
+    int l;
+    for (l = 0; l < ln->n; l++) ln->sp[l] = ln->usp;
+    ln->uni = 0;
+}
+
+// for each running lane l: x its sp, u its cell
+#define _bfl_each(body) for (l = 0; l < n; l++) if (ln->on[l]) { \
+                            x = ln->sp[l]; u = T + _bfl_at(x, l); \
+                            body \
+                        }
+// v: the lane's cell at offset buf
+#define _bfl_far        if (_mybounds(x + o->buf, cells)) { bf_laneFail(ln, l); continue; } \
+                        v = T + _bfl_at(x + o->buf, l);
+
+int bf_Lanes_run(bf_Lanes* ln, int icount) {
+    const bf_op* prog = (const bf_op*)ln->program->prog_op;
+    const bf_op *o, *m;
+    bf_cell* BF_RESTRICT T = ln->tape;
+    bf_cell* BF_RESTRICT u;
+    bf_cell* BF_RESTRICT v;
+    int n = ln->n, cells = ln->cells, l, x, k, any, yield;
+
+    while (ln->pc >= 0) {
+        o = prog + ln->pc;
+        yield = 0;
+
+        if (ln->uni) {
+            // converged: an op is one loop over n adjacent cells
+            x = ln->usp;
+            u = T + _bfl_at(x, 0);
+            if (o->cmd == bfo_PTR_S) { bf_lanesSplit(ln); continue; }
+            v = u;
+            if ((o->cmd >= bfo_MUL_MUL && o->cmd <= bfo_VAL_MUL) || o->cmd == bfo_VAL_IF) {
+                if (_mybounds(x + o->buf, cells)) { bf_lanesSplit(ln); continue; }
+                v = T + _bfl_at(x + o->buf, 0);
+            }
+            switch (o->cmd) {
+            case bfo_VAL:       for (l = 0; l < n; l++) u[l] += (bf_cell)o->val; break;
+            case bfo_VAL_ZERO:  for (l = 0; l < n; l++) u[l] = (bf_cell)o->val; break;
+            case bfo_VAL_MUL:   for (l = 0; l < n; l++) v[l] += (bf_cell)(o->val * u[l]); break;
+            case bfo_VAL_MZ:    for (l = 0; l < n; l++) { v[l] += (bf_cell)(o->val * u[l]); u[l] = 0; } break;
+            case bfo_MUL_MUL:   for (l = 0; l < n; l++) v[l] *= (bf_cell)(o->val * u[l]); break;
+            case bfo_VAL_IF:    for (l = 0; l < n; l++) { v[l] += (bf_cell)(u[l] ? o->val : 0); u[l] = 0; } break;
+            case bfo_PUT:       for (l = 0; l < n; l++) bf_lanePut(&ln->lane[l], u[l]); break;
+            case bfo_GET:       for (l = 0; l < n; l++) u[l] = bf_laneGet(&ln->lane[l]); break;
+            case bfo_FWD:
+            case bfo_REW:
+                for (l = k = 0; l < n; l++) k += (u[l] != 0);
+                if (k != 0 && k != n) { bf_lanesSplit(ln); continue; }
+                m = o + o->val;                 // the other end of the loop
+                if (o->cmd == bfo_FWD) {
+                    if (!k) o = m;              // skipped
+                    else if (bf_lanesPush(ln, 1) != 0) return bf_EVAL_ERROR;
+                } else if (k) {                 // back-edge
+                    o = m;
+                    yield = (--icount < 0);
+                } else {
+                    ln->depth--;
+                }
+                // the delta and step of the end it goes on from, as in Eval
+                for (l = 0; l < n; l++) u[l] += (bf_cell)o->buf;
+                break;
+            case bfo_EOP:
+                for (l = 0; l < n; l++) ln->lane[l].st = bf_EVAL_EOP;
+                ln->pc = -1;
+                continue;
+            default:
+                break;
+            }
+            ln->uniOps++;
+            ln->pc = (int)(o - prog) + 1;
+            if (_mybounds(x + o->off, cells)) {   // memory exception in every lane
+                bf_lanesSplit(ln);
+                for (l = 0; l < n; l++) bf_laneFail(ln, l);
+            }
+            else ln->usp = x + o->off;
+            if (yield) return bf_EVAL_BUDGET;
+            continue;
+        }
+
+        // diverged: lane by lane, under the mask
+        ln->laneOps++;
+        switch (o->cmd) {
+        case bfo_FWD:
+        case bfo_REW:
+            m = o + o->val;
+            if (o->cmd == bfo_FWD && bf_lanesPush(ln, 0) != 0) return bf_EVAL_ERROR;
+            any = 0;
+            _bfl_each(
+                // k: the lane stays in the loop, past FWD or round from REW;
+                // it goes on from the end it lands on, as in Eval
+                k = (*u != 0);
+                if (!k) ln->on[l] = 0;
+                m = ((o->cmd == bfo_FWD) == k) ? o : o + o->val;
+                *u += (bf_cell)m->buf;
+                x += m->off;
+                if (_mybounds(x, cells)) bf_laneFail(ln, l);
+                else { ln->sp[l] = x; any |= k; }
+            )
+            m = o + o->val;
+            if (!any) {                         // all out: after the REW
+                bf_lanesPop(ln);
+                ln->pc = (int)((o->cmd == bfo_FWD ? m : o) - prog) + 1;
+            } else if (o->cmd == bfo_FWD) {
+                ln->pc++;
+            } else {
+                ln->pc = (int)(m - prog) + 1;
+                if (--icount < 0) return bf_EVAL_BUDGET;
+            }
+            continue;
+
+        case bfo_EOP:
+            for (l = 0; l < n; l++) if (ln->lane[l].st == bf_EVAL_BUDGET) ln->lane[l].st = bf_EVAL_EOP;
+            ln->pc = -1;
+            continue;
+
+        case bfo_VAL:       _bfl_each(*u += (bf_cell)o->val;) break;
+        case bfo_VAL_ZERO:  _bfl_each(*u = (bf_cell)o->val;) break;
+        case bfo_VAL_MUL:   _bfl_each(_bfl_far *v += (bf_cell)(o->val * *u);) break;
+        case bfo_VAL_MZ:    _bfl_each(_bfl_far *v += (bf_cell)(o->val * *u); *u = 0;) break;
+        case bfo_MUL_MUL:   _bfl_each(_bfl_far *v *= (bf_cell)(o->val * *u);) break;
+        case bfo_VAL_IF:    _bfl_each(_bfl_far if (*u) { *v += (bf_cell)o->val; *u = 0; }) break;
+        case bfo_PUT:       _bfl_each(bf_lanePut(&ln->lane[l], *u);) break;
+        case bfo_GET:       _bfl_each(*u = bf_laneGet(&ln->lane[l]);) break;
+        case bfo_PTR_S:
+            _bfl_each(
+                while (*u && !_mybounds(x + o->val, cells)) { x += o->val; u = T + _bfl_at(x, l); }
+                if (*u) bf_laneFail(ln, l);
+                else ln->sp[l] = x;
+            )
+            break;
+        default:
+            break;
+        }
+        if (o->off) _bfl_each(if (_mybounds(x + o->off, cells)) bf_laneFail(ln, l); else ln->sp[l] = x + o->off;)
+        if (o->cmd == bfo_PTR_S) bf_lanesJoin(ln);
+        ln->pc++;
+    }
+    return bf_EVAL_EOP;
+}
+
+// =====================================================================
+// loop profile file: "bffsree-profile 1 <hash> <loops>" then "<id> <entries> <iters>"
+// =====================================================================
+int bf_Profile_load(bf_Profile* prof, const char* path) {
+    FILE* fh = fopen(path, "r");
+    unsigned long long e, n;
+    unsigned long h;
+    int id, count;
+
+    memset(prof, 0, sizeof(*prof));
+    if (!fh) return -1;
+    if (fscanf(fh, "bffsree-profile 1 %lu %d", &h, &count) != 2 || count < 0) { fclose(fh); return -1; }
+    prof->loops = (bf_loopProf*)calloc((size_t)count + 1, sizeof(bf_loopProf));
+    if (!prof->loops) { fclose(fh); return -1; }
+    prof->hash      = (uint32_t)h;
+    prof->loopCount = count;
+    while (fscanf(fh, "%d %llu %llu", &id, &e, &n) == 3) {
+        if (id < 0 || id >= count) continue;
+        prof->loops[id].entries = e;
+        prof->loops[id].iters   = n;
+    }
+    fclose(fh);
+    return 0;
+}
+
+int bf_Profile_save(const bf_Profile* prof, const char* path) {
+    FILE* fh = fopen(path, "w");
+    int i;
+
+    if (!fh) return -1;
+    fprintf(fh, "bffsree-profile 1 %lu %d\n", (unsigned long)prof->hash, prof->loopCount);
+    for (i = 0; i < prof->loopCount; i++) {
+        if (prof->loops[i].entries == 0) continue;
+        fprintf(fh, "%d %llu %llu\n", i, (unsigned long long)prof->loops[i].entries,
+                (unsigned long long)prof->loops[i].iters);
+    }
+    fclose(fh);
+    return 0;
+}
+
+void bf_Profile_free(bf_Profile* prof) {
+    _myfree(prof->loops);
+    prof->loopCount = 0;
+}
+
+// =====================================================================
+// threads, locks, clock and 64-bit atomics (batch runner, scheduler, pipeline)
+// =====================================================================
+#if defined(_WIN32)
+typedef HANDLE bf_thread;
+#define BF_THREAD_PROC(name, arg)   static DWORD WINAPI name(void* arg)
+#define bf_threadStart(t, fn, arg)  ((*(t) = CreateThread(0, 0, (fn), (arg), 0, 0)) != 0)
+#define bf_threadJoin(t)            (WaitForSingleObject((t), INFINITE), CloseHandle(t))
+typedef CRITICAL_SECTION   bf_mutex;
+typedef CONDITION_VARIABLE bf_cond;
+#define bf_mutexInit(m)             InitializeCriticalSection(m)
+#define bf_mutexFree(m)             DeleteCriticalSection(m)
+#define bf_lock(m)                  EnterCriticalSection(m)
+#define bf_unlock(m)                LeaveCriticalSection(m)
+#define bf_condInit(c)              InitializeConditionVariable(c)
+#define bf_condFree(c)              ((void)(c))
+#define bf_condWait(c, m)           SleepConditionVariableCS((c), (m), INFINITE)
+#define bf_condSignal(c)            WakeConditionVariable(c)
+#define bf_condBroadcast(c)         WakeAllConditionVariable(c)
+
+static double bf_now(void) {
+    LARGE_INTEGER f, c;
+    QueryPerformanceFrequency(&f);
+    QueryPerformanceCounter(&c);
+    return (double)c.QuadPart / (double)f.QuadPart;
+}
+
+static int bf_cpuCount(void) {
+    SYSTEM_INFO si;
+    GetSystemInfo(&si);
+    return (int)si.dwNumberOfProcessors;
+}
+
+static uint64_t bf_load64(volatile uint64_t* p) { return (uint64_t)InterlockedCompareExchange64((volatile LONG64*)p, 0, 0); }
+static int bf_cas64(volatile uint64_t* p, uint64_t o, uint64_t n) {
+    return InterlockedCompareExchange64((volatile LONG64*)p, (LONG64)n, (LONG64)o) == (LONG64)o;
+}
+static void bf_store64(volatile uint64_t* p, uint64_t v) { InterlockedExchange64((volatile LONG64*)p, (LONG64)v); }
+#define bf_fence()                  MemoryBarrier()
+#else
+typedef pthread_t bf_thread;
+#define BF_THREAD_PROC(name, arg)   static void* name(void* arg)
+#define bf_threadStart(t, fn, arg)  (pthread_create((t), 0, (fn), (arg)) == 0)
+#define bf_threadJoin(t)            pthread_join((t), 0)
+typedef pthread_mutex_t bf_mutex;
+typedef pthread_cond_t  bf_cond;
+#define bf_mutexInit(m)             pthread_mutex_init((m), 0)
+#define bf_mutexFree(m)             pthread_mutex_destroy(m)
+#define bf_lock(m)                  pthread_mutex_lock(m)
+#define bf_unlock(m)                pthread_mutex_unlock(m)
+#define bf_condInit(c)              pthread_cond_init((c), 0)
+#define bf_condFree(c)              pthread_cond_destroy(c)
+#define bf_condWait(c, m)           pthread_cond_wait((c), (m))
+#define bf_condSignal(c)            pthread_cond_signal(c)
+#define bf_condBroadcast(c)         pthread_cond_broadcast(c)
+
+static double bf_now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec + (double)ts.tv_nsec * 1e-9;
+}
+
+static int bf_cpuCount(void) {
+    long n = sysconf(_SC_NPROCESSORS_ONLN);
+    return n > 0 ? (int)n : 1;
+}
+
+static uint64_t bf_load64(volatile uint64_t* p) { return __atomic_load_n(p, __ATOMIC_ACQUIRE); }
+static int bf_cas64(volatile uint64_t* p, uint64_t o, uint64_t n) {
+    return __atomic_compare_exchange_n(p, &o, n, 0, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE);
+}
+static void bf_store64(volatile uint64_t* p, uint64_t v) { __atomic_store_n(p, v, __ATOMIC_RELEASE); }
+#define bf_fence()                  __atomic_thread_fence(__ATOMIC_SEQ_CST)
+#endif
+
+// =====================================================================
+// batch: manifest jobs on a work-stealing pool of threads
+// =====================================================================
+// manifest lines: "<program> <input> <output>", '-' for no input / stdout;
+// blank lines and lines starting with '#' are skipped
+typedef struct bf_BatchJob {
+    const char* prog;           // manifest fields (into the manifest text)
+    const char* in;
+    const char* out;
+    bf_Program* program;        // shared by every job naming the same file
+    char*       buf;            // output, written out when the job is done
+    size_t      len, cap;
+    size_t      inLen;
+    double      secs;
+    int         st;             // bf_EVAL_ status
+    const char* err;            // why the job didn't run or its output was lost
+} bf_BatchJob;
+
+typedef struct bf_Batch {
+    bf_BatchJob*       jobs;
+    int                workers;
+    volatile uint64_t* queue;   // per worker: jobs lo (low word) .. hi not taken yet
+} bf_Batch;
+
+typedef struct bf_BatchWorker {
+    bf_Batch* b;
+    int       id;
+} bf_BatchWorker;
+
+#define _bf_range(lo, hi)   ((uint64_t)(uint32_t)(lo) | (uint64_t)(hi) << 32)
+
+static int bf_batchWrite(void* data, const char* buf, size_t n) {
+    bf_BatchJob* j = (bf_BatchJob*)data;
+    _myresize(j->buf, j->cap, j->len + n);
+    if (!j->buf) { j->len = j->cap = 0; j->err = "out of memory"; return (int)n; }
+    memcpy(j->buf + j->len, buf, n);
+    j->len += n;
+    return (int)n;
+}
+
+static int bf_batchEOF(void* data, char* buf, size_t n) { (void)data; (void)buf; (void)n; return 0; }
+
+// the next job for worker w: its own range from the bottom, else the top
+// half of another worker's range (which becomes w's range). -1: all taken
+static int bf_batchTake(bf_Batch* b, int w) {
+    uint64_t r;
+    uint32_t lo, hi, mid;
+    int i, v;
+
+    for (;;) {
+        r = bf_load64(&b->queue[w]);
+        lo = (uint32_t)r; hi = (uint32_t)(r >> 32);
+        if (lo >= hi) break;
+        if (bf_cas64(&b->queue[w], r, _bf_range(lo + 1, hi))) return (int)lo;
+    }
+    for (i = 1; i < b->workers; i++) {
+        v = (w + i) % b->workers;
+        for (;;) {
+            r = bf_load64(&b->queue[v]);
+            lo = (uint32_t)r; hi = (uint32_t)(r >> 32);
+            if (lo >= hi) break;
+            mid = lo + (hi - lo) / 2;
+            if (!bf_cas64(&b->queue[v], r, _bf_range(lo, mid))) continue;
+            // only w refills its own (empty) range, so a plain swap will do
+            while (!bf_cas64(&b->queue[w], bf_load64(&b->queue[w]), _bf_range(mid + 1, hi)));
+            return (int)mid;
+        }
+    }
+    return -1;
+}
+
+static void bf_batchRun(bf_BatchJob* j) {
+    char* in = 0;
+    size_t mapped = 0;
+    double t = bf_now();
+    FILE* fh;
+    bf_VM* vm;
+
+    if (!j->program) return;
+    if (strcmp(j->in, "-") != 0) {
+        j->inLen = mapped = bf_mapfile(&in, j->in);
+        if (!in) {
+            if (!(fh = fopen(j->in, "rb"))) { j->err = "unable to open input"; return; }
+            j->inLen = bf_readfile(0, &in, fh);
+            fclose(fh);
+        }
+    }
+    if (!(vm = bf_VM_acquire())) { j->err = "out of memory"; }
+    else {
+        vm->writep = bf_batchWrite; vm->writedata = j;
+        vm->readp  = bf_batchEOF;
+        if (in) bf_VM_input(vm, in, j->inLen);
+        bf_VM_load(vm, j->program);
+        do {
+            j->st = bffsree_Eval(vm, 0, 1 << 30);
+        } while (j->st == bf_EVAL_BUDGET);
+        bf_VM_release(vm);
+    }
+#if !defined(_WIN32)
+    if (mapped) { munmap(in, mapped); in = 0; }
+#endif
+    free(in);
+    j->secs = bf_now() - t;
+
+    if (strcmp(j->out, "-") != 0) {
+        if (!(fh = fopen(j->out, "wb"))) j->err = "unable to open output";
+        else {
+            if (fwrite(j->buf, 1, j->len, fh) != j->len) j->err = "unable to write output";
+            if (fclose(fh) != 0) j->err = "unable to write output";
+        }
+        _myfree(j->buf);
+    }
+}
+
+BF_THREAD_PROC(bf_batchWorker, arg) {
+    bf_BatchWorker* wk = (bf_BatchWorker*)arg;
+    int k;
+
+    while ((k = bf_batchTake(wk->b, wk->id)) >= 0) bf_batchRun(&wk->b->jobs[k]);
+    bf_VM_poolDrain();
+    return 0;
+}
+
+// runs a manifest on `workers` threads (the caller's among them); the output
+// of '-' jobs goes to stdout in manifest order once all are done, then a
+// "//--" line per job and the totals. Returns 0 if every job ran to its end
+static int bf_batch(const char* path, int workers) {
+    bf_Batch b = {0, 0, 0};
+    bf_BatchWorker* wk = 0;
+    bf_thread* th = 0;
+    bf_Program** progs = 0;
+    char *text = 0, *p, *f[3], *src;
+    size_t n, srclen, mapped;
+    size_t inBytes = 0, outBytes = 0;
+    int njobs = 0, cap = 0, nprogs = 0, started = 1, line = 0, rc = 0, i, k;
+    double t, wall, busy = 0;
+    FILE* fh;
+
+    if (!(fh = fopen(path, "rb"))) { printf("//unable to open manifest [%s]\n", path); return -1; }
+    n = bf_readfile(0, &text, fh);
+    fclose(fh);
+    if (!text) return -1;
+
+    // jobs, split into fields in place
+    for (p = text; p < text + n; ) {
+        for (k = 0; k < 3; k++) {
+            while (*p == ' ' || *p == '\t' || *p == '\r') p++;
+            f[k] = p;
+            if (*p == '\n' || *p == 0 || (k == 0 && *p == '#')) break;
+            while (*p && *p != ' ' && *p != '\t' && *p != '\r' && *p != '\n') p++;
+            if (*p && *p != '\n') *p++ = 0;
+        }
+        while (*p == ' ' || *p == '\t' || *p == '\r') p++;
+        line++;
+        if (k == 3 && (*p == '\n' || *p == 0)) {
+            _myresize(b.jobs, cap, njobs + 1);
+            memset(&b.jobs[njobs], 0, sizeof(bf_BatchJob));
+            b.jobs[njobs].prog = f[0]; b.jobs[njobs].in = f[1]; b.jobs[njobs].out = f[2];
+            b.jobs[njobs].st = bf_EVAL_ERROR;
+            njobs++;
+        } else if (!(k == 0 && (*f[0] == '\n' || *f[0] == '#' || *f[0] == 0))) {
+            printf("//manifest line %d needs <program> <input> <output> [%s]\n", line, path);
+            rc = -1;
+        }
+        while (*p && *p != '\n') p++;
+        if (*p == '\n') *p++ = 0;
+    }
+
+    // one compile per distinct program file
+    if (!(progs = (bf_Program**)calloc((size_t)njobs + 1, sizeof(bf_Program*)))) njobs = 0;
+    for (i = 0; i < njobs; i++) {
+        for (k = 0; k < i && strcmp(b.jobs[k].prog, b.jobs[i].prog) != 0; k++);
+        if (k < i) { b.jobs[i].program = b.jobs[k].program; b.jobs[i].err = b.jobs[k].err; continue; }
+        srclen = mapped = bf_mapfile(&src, b.jobs[i].prog);
+        if (!src && (fh = fopen(b.jobs[i].prog, "rb"))) { srclen = bf_readfile(0, &src, fh); fclose(fh); }
+        if (!src) { b.jobs[i].err = "unable to open program"; continue; }
+        if (!(b.jobs[i].program = progs[nprogs] = bf_Program_compile(src, srclen, 0, 0)))
+            b.jobs[i].err = "unable to compile program";
+        else nprogs++;
+#if !defined(_WIN32)
+        if (mapped) { munmap(src, mapped); src = 0; }
+#endif
+        free(src);
+    }
+
+    // every worker starts with an equal slice of the manifest
+    if (workers > njobs) workers = njobs;
+    if (workers < 1) workers = 1;
+    b.workers = workers;
+    b.queue = (volatile uint64_t*)calloc((size_t)workers, sizeof(uint64_t));
+    wk = (bf_BatchWorker*)calloc((size_t)workers, sizeof(bf_BatchWorker));
+    th = (bf_thread*)calloc((size_t)workers, sizeof(bf_thread));
+    if (!b.queue || !wk || !th || !progs) { printf("//out of memory\n"); workers = 0; rc = -1; }
+    for (i = 0; i < workers; i++) {
+        b.queue[i] = _bf_range((int64_t)njobs * i / workers, (int64_t)njobs * (i + 1) / workers);
+        wk[i].b = &b; wk[i].id = i;
+    }
+    t = bf_now();
+    for (i = 1; i < workers; i++) {
+        if (!bf_threadStart(&th[i], bf_batchWorker, &wk[i])) break;
+        started++;
+    }
+    if (workers) bf_batchWorker(&wk[0]);  // also takes the slices of threads that didn't start
+    for (i = 1; i < started; i++) bf_threadJoin(th[i]);
+    wall = bf_now() - t;
+
+    // output of '-' jobs, then the report
+    for (i = 0; i < njobs; i++)
+        if (b.jobs[i].buf) { fwrite(b.jobs[i].buf, 1, b.jobs[i].len, stdout); _myfree(b.jobs[i].buf); }
+    for (i = 0; i < njobs; i++) {
+        bf_BatchJob* j = &b.jobs[i];
+        if (!j->err && j->st == bf_EVAL_ERROR) j->err = "memory exception";
+        if (j->err) rc = -1;
+        inBytes += j->inLen; outBytes += j->len; busy += j->secs;
+        printf("//-- job %d: %s < %s > %s: %.3f ms, %lu B in, %lu B out, %.1f MB/s%s%s\n", i + 1,
+               j->prog, j->in, j->out, j->secs * 1e3, (unsigned long)j->inLen, (unsigned long)j->len,
+               j->secs > 0 ? (double)(j->inLen + j->len) / j->secs / 1e6 : 0.0, j->err ? " - " : "", j->err ? j->err : "");
+    }
+    printf("//-- batch: %d jobs, %d programs, %d threads: %.3f s, %.0f jobs/s, %.1f MB/s, %.2f busy threads\n",
+           njobs, nprogs, started, wall, wall > 0 ? njobs / wall : 0.0,
+           wall > 0 ? (double)(inBytes + outBytes) / wall / 1e6 : 0.0, wall > 0 ? busy / wall : 0.0);
+
+    for (i = 0; i < nprogs; i++) bf_Program_release(progs[i]);
+    free(progs);
+    free(th);
+    free(wk);
+    free((void*)b.queue);
+    free(b.jobs);
+    free(text);
+    return rc;
+}
+
+// lanes from the command line: each stdin line (with its '\n') is the input
+// of one run of the program, width runs at a time; their outputs go to
+// stdout in line order
+static int bf_lanes(const char* path, int width, int metric) {
+    bf_OptOptions opt = {bf_OPT_LANES, 0, 0};
+    bf_Program* p = 0;
+    bf_Lanes ln;
+    char *src = 0, *text = 0, *q, *e;
+    size_t srclen, mapped, n;
+    long long uniOps = 0, laneOps = 0;
+    int runs = 0, l, k, rc = 0;
+    FILE* fh;
+
+    srclen = mapped = bf_mapfile(&src, path);
+    if (!src && (fh = fopen(path, "rb"))) { srclen = bf_readfile(0, &src, fh); fclose(fh); }
+    if (!src) { printf("//unable to open file [%s]\n", path); return -1; }
+    p = bf_Program_compile(src, srclen, 0, &opt);
+#if !defined(_WIN32)
+    if (mapped) { munmap(src, mapped); src = 0; }
+#endif
+    free(src);
+    if (!p) { printf("//unable to compile [%s]\n", path); return -1; }
+
+    n = bf_readfile(0, &text, stdin);
+    for (q = text; q && q < text + n; ) {
+        for (k = 0, e = q; k < width && e < text + n; k++) {    // up to width lines
+            e = (char*)memchr(e, '\n', (size_t)(text + n - e));
+            e = e ? e + 1 : text + n;
+        }
+        if (bf_Lanes_init(&ln, p, k, 65536) != 0) { printf("//unable to run lanes of [%s]\n", path); rc = -1; break; }
+        for (l = 0; l < k; l++, q = e) {
+            e = (char*)memchr(q, '\n', (size_t)(text + n - q));
+            e = e ? e + 1 : text + n;
+            bf_Lanes_input(&ln, l, q, (size_t)(e - q));
+        }
+        while (bf_Lanes_run(&ln, 10000) == bf_EVAL_BUDGET);
+        for (l = 0; l < k; l++) {
+            fwrite(ln.lane[l].out, 1, ln.lane[l].outLen, stdout);
+            if (ln.lane[l].st == bf_EVAL_ERROR) printf("// memory exception\n");
+        }
+        uniOps += ln.uniOps; laneOps += ln.laneOps; runs += k;
+        bf_Lanes_free(&ln);
+    }
+    if (metric && uniOps + laneOps > 0)
+        printf("//-- Lanes: %d runs, %d wide: %.1f%% of ops converged (%lld together, %lld lane by lane)\n",
+               runs, width, 100.0 * (double)uniOps / (double)(uniOps + laneOps), uniOps, laneOps);
+    bf_Program_release(p);
+    free(text);
+    return rc;
+}
+
+// =====================================================================
+// scheduler: many VMs in turns on a few threads
+// =====================================================================
+enum { bf_TASK_READY = 0, bf_TASK_PARKED };   // task state, under the scheduler's lock
+
+#if defined(_WIN32)
+#define BF_POLLIN   1
+#define BF_POLLOUT  4
+#else
+#define BF_POLLIN   POLLIN
+#define BF_POLLOUT  POLLOUT
+#endif
+
+typedef struct bf_RunQ {
+    bf_mutex lock;
+    bf_Task *head, *tail;
+} bf_RunQ;
+
+typedef struct bf_SchedWorker {
+    bf_Sched* s;
+    int       id;
+} bf_SchedWorker;
+
+struct bf_Sched {
+    int             workers, slice;
+    bf_RunQ*        queues;     // one per worker: its tasks, in turn order
+    bf_SchedWorker* ws;
+    bf_thread*      threads;
+    int             started;
+    int             queued;     // tasks in all run queues (atomic)
+    int             rr;         // next queue for a new or woken task (atomic)
+    bf_mutex        lock;       // the rest, and task state/woken
+    bf_cond         work, idle;
+    int             live, stop;
+    bf_Task*        parked;     // suspended on an fd, not yet with the poller
+    bf_thread       poller;
+    int             pollerOn;
+    int             wake[2];    // pipe: rouses the poller for new parked tasks
+};
+
+static void bf_schedPush(bf_Sched* s, bf_Task* t, int q) {
+    bf_RunQ* r = &s->queues[q];
+    t->next = 0;
+    bf_lock(&r->lock);
+    if (r->tail) r->tail->next = t; else r->head = t;
+    r->tail = t;
+    bf_unlock(&r->lock);
+    bf_atomicInc(&s->queued);
+    bf_lock(&s->lock);
+    bf_condSignal(&s->work);
+    bf_unlock(&s->lock);
+}
+
+static int bf_schedNextQ(bf_Sched* s) { return (int)((unsigned)bf_atomicInc(&s->rr) % (unsigned)s->workers); }
+
+// worker w's next task: the head of its own queue, else of the next
+// queue that has one
+static bf_Task* bf_schedPop(bf_Sched* s, int w) {
+    bf_RunQ* r;
+    bf_Task* t;
+    int i;
+
+    for (i = 0; i < s->workers; i++) {
+        r = &s->queues[(w + i) % s->workers];
+        bf_lock(&r->lock);
+        if ((t = r->head) != 0 && !(r->head = t->next)) r->tail = 0;
+        bf_unlock(&r->lock);
+        if (t) { bf_atomicDec(&s->queued); return t; }
+    }
+    return 0;
+}
+
+static void bf_schedDone(bf_Sched* s, bf_Task* t) {
+    if (t->done) t->done(t);    // t may be gone after this
+    bf_lock(&s->lock);
+    if (--s->live == 0) bf_condBroadcast(&s->idle);
+    bf_unlock(&s->lock);
+}
+
+// suspended on I/O: to the poller with its fd, or asleep until bf_Sched_wake
+// (unless that came while it ran)
+static void bf_schedPark(bf_Sched* s, bf_Task* t, int fd, short ev, int w) {
+    bf_lock(&s->lock);
+    if (t->woken) {
+        t->woken = 0;
+        bf_unlock(&s->lock);
+        bf_schedPush(s, t, w);
+        return;
+    }
+    t->state = fd >= 0 ? bf_TASK_READY : bf_TASK_PARKED;   // the poller requeues fd waits
+    t->pollFd = fd;
+    t->pollEv = ev;
+    if (fd >= 0) {
+        t->next = s->parked;
+        s->parked = t;
+#if !defined(_WIN32)
+        if (write(s->wake[1], "", 1) < 0) {}    // full: the poller is awake anyway
+#endif
+    }
+    bf_unlock(&s->lock);
+}
+
+// one turn: weight slices of budget (less what is left of its fuel)
+static void bf_schedTurn(bf_Sched* s, bf_Task* t, int w) {
+    long long n = (long long)s->slice * (t->weight > 0 ? t->weight : 1);
+    int st;
+
+    if (t->fuel > 0) n = _mymin(n, t->fuel);
+    n = _mymin(n, INT_MAX);
+    st = t->st = bffsree_Eval(t->vm, 0, (int)n);
+    if (st == bf_EVAL_BUDGET) {
+        if (t->fuel > 0 && (t->fuel -= n) <= 0) bf_schedDone(s, t);
+        else bf_schedPush(s, t, w);
+    }
+    else if (st == bf_EVAL_INPUT)  bf_schedPark(s, t, t->fdIn,  BF_POLLIN,  w);
+    else if (st == bf_EVAL_OUTPUT) bf_schedPark(s, t, t->fdOut, BF_POLLOUT, w);
+    else bf_schedDone(s, t);
+}
+
+BF_THREAD_PROC(bf_schedWorker, arg) {
+    bf_SchedWorker* wk = (bf_SchedWorker*)arg;
+    bf_Sched* s = wk->s;
+    bf_Task* t;
+    int stop = 0;
+
+    while (!stop) {
+        if ((t = bf_schedPop(s, wk->id)) != 0) { bf_schedTurn(s, t, wk->id); continue; }
+        bf_lock(&s->lock);
+        while (!s->stop && bf_atomicLoad(&s->queued) == 0) bf_condWait(&s->work, &s->lock);
+        stop = s->stop;
+        bf_unlock(&s->lock);
+    }
+    return 0;
+}
+
+// waits on the fds of parked tasks and queues those that became ready;
+// without poll() (Windows) it retries them every millisecond
+BF_THREAD_PROC(bf_schedPoller, arg) {
+    bf_Sched* s = (bf_Sched*)arg;
+    bf_Task *t, *next, **ts = 0;
+    int n = 0, cap = 0, i;
+#if !defined(_WIN32)
+    struct pollfd* fds = 0;
+    int fcap = 0;
+    char drain[64];
+#endif
+
+    for (;;) {
+        bf_lock(&s->lock);
+        if (s->stop) { bf_unlock(&s->lock); break; }
+        for (t = s->parked; t; t = next) {
+            next = t->next;
+            _myresize(ts, cap, n + 2);
+            ts[++n] = t;                        // slot 0 is the wake pipe
+        }
+        s->parked = 0;
+        bf_unlock(&s->lock);
+#if defined(_WIN32)
+        Sleep(1);
+        for (; n > 0; n--) bf_schedPush(s, ts[n], bf_schedNextQ(s));
+#else
+        _myresize(fds, fcap, n + 1);
+        fds[0].fd = s->wake[0]; fds[0].events = POLLIN;
+        for (i = 1; i <= n; i++) { fds[i].fd = ts[i]->pollFd; fds[i].events = ts[i]->pollEv; }
+        if (poll(fds, (nfds_t)n + 1, -1) < 0) continue;
+        if (fds[0].revents) while (read(s->wake[0], drain, sizeof(drain)) > 0) {}
+        for (i = n; i >= 1; i--) {              // ready, hung up or failed: its turn tells
+            if (!fds[i].revents) continue;
+            t = ts[i];
+            ts[i] = ts[n];
+            n--;
+            bf_schedPush(s, t, bf_schedNextQ(s));
+        }
+#endif
+    }
+    (void)i;
+    _myfree(ts);
+#if !defined(_WIN32)
+    _myfree(fds);
+#endif
+    return 0;
+}
+
+bf_Sched* bf_Sched_create(int workers, int slice) {
+    bf_Sched* s = (bf_Sched*)calloc(1, sizeof(bf_Sched));
+    int i;
+
+    if (!s) return 0;
+    s->workers = workers > 0 ? workers : bf_cpuCount();
+    s->slice   = slice > 0 ? slice : 10000;
+    s->wake[0] = s->wake[1] = -1;
+    s->queues  = (bf_RunQ*)calloc((size_t)s->workers, sizeof(bf_RunQ));
+    s->ws      = (bf_SchedWorker*)calloc((size_t)s->workers, sizeof(bf_SchedWorker));
+    s->threads = (bf_thread*)calloc((size_t)s->workers, sizeof(bf_thread));
+    if (!s->queues || !s->ws || !s->threads) { free(s->queues); free(s->ws); free(s->threads); free(s); return 0; }
+    bf_mutexInit(&s->lock);
+    bf_condInit(&s->work);
+    bf_condInit(&s->idle);
+    for (i = 0; i < s->workers; i++) { bf_mutexInit(&s->queues[i].lock); s->ws[i].s = s; s->ws[i].id = i; }
+#if !defined(_WIN32)
+    if (pipe(s->wake) != 0) { s->wake[0] = s->wake[1] = -1; bf_Sched_destroy(s); return 0; }
+    fcntl(s->wake[0], F_SETFL, O_NONBLOCK);
+    fcntl(s->wake[1], F_SETFL, O_NONBLOCK);
+#endif
+    for (s->started = 0; s->started < s->workers; s->started++)
+        if (!bf_threadStart(&s->threads[s->started], bf_schedWorker, &s->ws[s->started])) break;
+    s->pollerOn = bf_threadStart(&s->poller, bf_schedPoller, s);
+    if (!s->started || !s->pollerOn) { bf_Sched_destroy(s); return 0; }
+    return s;
+}
+
+int bf_Sched_spawn(bf_Sched* s, bf_Task* t) {
+    if (!t->vm || !t->vm->prog_op) return -1;
+    t->sched = s;
+    t->state = bf_TASK_READY;
+    t->woken = 0;
+    t->st = bf_EVAL_BUDGET;
+    bf_lock(&s->lock);
+    s->live++;
+    bf_unlock(&s->lock);
+    bf_schedPush(s, t, bf_schedNextQ(s));
+    return 0;
+}
+
+void bf_Sched_wake(bf_Task* t) {
+    bf_Sched* s = t->sched;
+    int run = 0;
+
+    bf_lock(&s->lock);
+    if (t->state == bf_TASK_PARKED && t->pollFd < 0) { t->state = bf_TASK_READY; run = 1; }
+    else t->woken = 1;      // running, queued or on the poller: its next park returns
+    bf_unlock(&s->lock);
+    if (run) bf_schedPush(s, t, bf_schedNextQ(s));
+}
+
+void bf_Sched_wait(bf_Sched* s) {
+    bf_lock(&s->lock);
+    while (s->live > 0) bf_condWait(&s->idle, &s->lock);
+    bf_unlock(&s->lock);
+}
+
+void bf_Sched_destroy(bf_Sched* s) {
+    int i;
+
+    if (!s) return;
+    bf_lock(&s->lock);
+    s->stop = 1;
+    bf_condBroadcast(&s->work);
+    bf_unlock(&s->lock);
+#if !defined(_WIN32)
+    if (s->wake[1] >= 0 && write(s->wake[1], "", 1) < 0) {}
+#endif
+    for (i = 0; i < s->started; i++) bf_threadJoin(s->threads[i]);
+    if (s->pollerOn) bf_threadJoin(s->poller);
+#if !defined(_WIN32)
+    if (s->wake[0] >= 0) { close(s->wake[0]); close(s->wake[1]); }
+#endif
+    for (i = 0; i < s->workers; i++) bf_mutexFree(&s->queues[i].lock);
+    bf_condFree(&s->work);
+    bf_condFree(&s->idle);
+    bf_mutexFree(&s->lock);
+    free(s->queues);
+    free(s->ws);
+    free(s->threads);
+    free(s);
+}
+
+// =====================================================================
+// pipeline: stages on threads, joined by rings
+// =====================================================================
+// single producer, single consumer. The writer owns head and the reader
+// tail; each copies as much as fits and publishes its counter. Only a
+// full or empty ring takes the lock, to sleep until the other side moves
+// or is done.
+typedef struct bf_Ring {
+    char*             buf;
+    volatile uint64_t head;         // bytes written so far
+    char              pad0[64];
+    volatile uint64_t tail;         // bytes read so far
+    char              pad1[64];
+    volatile int      waiting;      // a side is (about to be) asleep on wake
+    volatile int      closed;       // the writer is done: EOF once empty
+    volatile int      gone;         // the reader is done: writes are dropped
+    bf_mutex          lock;
+    bf_cond           wake;
+} bf_Ring;
+
+typedef struct bf_Stage {
+    bf_Program* program;
+    bf_Ring*    in;                 // 0: stdin (through sin, if set)
+    bf_Ring*    out;                // 0: stdout (through sout, if set)
+    bf_Stream*  sin;
+    bf_Stream*  sout;
+    bf_thread   thread;
+    int         st, started;
+    double      secs;
+} bf_Stage;
+
+// sleeps until *p is past seen or *stop is set
+static void bf_ringWait(bf_Ring* r, volatile uint64_t* p, uint64_t seen, volatile int* stop) {
+    bf_lock(&r->lock);
+    bf_atomicInc(&r->waiting);
+    bf_fence();     // pairs with bf_ringPoke's: one of the two sees the other's store
+    while (bf_load64(p) == seen && !bf_atomicLoad(stop)) bf_condWait(&r->wake, &r->lock);
+    bf_atomicDec(&r->waiting);
+    bf_unlock(&r->lock);
+}
+
+// after head or tail moved: wakes the other side if it sleeps
+static void bf_ringPoke(bf_Ring* r) {
+    bf_fence();
+    if (bf_atomicLoad(&r->waiting)) {
+        bf_lock(&r->lock);
+        bf_condBroadcast(&r->wake);
+        bf_unlock(&r->lock);
+    }
+}
+
+static void bf_ringClose(bf_Ring* r, volatile int* flag) {
+    bf_lock(&r->lock);
+    bf_atomicInc(flag);
+    bf_condBroadcast(&r->wake);
+    bf_unlock(&r->lock);
+}
+
+// writep: all n bytes, waiting while the ring is full; fewer only once
+// the reader is gone
+static int bf_ringWrite(void* data, const char* buf, size_t n) {
+    bf_Ring* r = (bf_Ring*)data;
+    uint64_t head = r->head, tail;
+    size_t done = 0, k, at;
+
+    while (done < n) {
+        tail = bf_load64(&r->tail);
+        if (bf_atomicLoad(&r->gone)) break;
+        if (head - tail == BF_RING) { bf_ringWait(r, &r->tail, tail, &r->gone); continue; }
+        at = (size_t)(head & (BF_RING - 1));
+        k  = _mymin(n - done, (size_t)(BF_RING - (head - tail)));
+        k  = _mymin(k, BF_RING - at);
+        memcpy(r->buf + at, buf + done, k);
+        head += k;
+        done += k;
+        bf_store64(&r->head, head);
+        bf_ringPoke(r);
+    }
+    return (int)done;
+}
+
+// readp: what is there, up to n bytes, waiting while the ring is empty;
+// 0 (EOF) once it is empty and closed
+static int bf_ringRead(void* data, char* buf, size_t n) {
+    bf_Ring* r = (bf_Ring*)data;
+    uint64_t tail = r->tail, head;
+    size_t k, at;
+
+    while ((head = bf_load64(&r->head)) == tail) {
+        if (bf_atomicLoad(&r->closed)) {
+            if (bf_load64(&r->head) == tail) return 0;
+        }
+        else bf_ringWait(r, &r->head, tail, &r->closed);
+    }
+    at = (size_t)(tail & (BF_RING - 1));
+    k  = _mymin(n, (size_t)(head - tail));
+    k  = _mymin(k, BF_RING - at);
+    memcpy(buf, r->buf + at, k);
+    bf_store64(&r->tail, tail + k);
+    bf_ringPoke(r);
+    return (int)k;
+}
+
+BF_THREAD_PROC(bf_stageRun, arg) {
+    bf_Stage* sg = (bf_Stage*)arg;
+    double t = bf_now();
+    bf_VM* vm;
+
+    sg->st = bf_EVAL_ERROR;
+    if ((vm = bf_VM_acquire())) {
+        if (sg->in)        { vm->readp  = bf_ringRead;     vm->readdata  = sg->in; }
+        else if (sg->sin)  { vm->readp  = bf_Stream_read;  vm->readdata  = sg->sin; }
+        if (sg->out)       { vm->writep = bf_ringWrite;    vm->writedata = sg->out; }
+        else if (sg->sout) { vm->writep = bf_Stream_write; vm->writedata = sg->sout; }
+        bf_VM_load(vm, sg->program);
+        do {
+            sg->st = bffsree_Eval(vm, 0, 1 << 30);
+        } while (sg->st == bf_EVAL_BUDGET);
+        bf_VM_release(vm);
+    }
+    // what is upstream has no reader now, what is downstream gets EOF
+    if (sg->in)  bf_ringClose(sg->in, &sg->in->gone);
+    if (sg->out) bf_ringClose(sg->out, &sg->out->closed);
+    else if (!sg->sout) fflush(stdout);
+    sg->secs = bf_now() - t;
+    return 0;
+}
+
+// runs the programs at paths[0..n) as one pipeline, a thread per stage:
+// stdin into the first, each one's output into the next one's input, the
+// last one's output to stdout (both through bf_Stream with streams set)
+static int bf_pipeline(char** paths, int n, int streams, int metric) {
+    bf_Stage* sg;
+    bf_Ring* rings;
+    bf_Stream sin, sout;
+    char* src;
+    size_t srclen, mapped, moved = 0;
+    int i, rc = 0;
+    double t = bf_now();
+    FILE* fh;
+
+    sg    = (bf_Stage*)calloc((size_t)n, sizeof(bf_Stage));
+    rings = (bf_Ring*)calloc((size_t)n, sizeof(bf_Ring));
+    if (!sg || !rings) { free(sg); free(rings); return -1; }
+    for (i = 0; i < n; i++) {
+        srclen = mapped = bf_mapfile(&src, paths[i]);
+        if (!src && (fh = fopen(paths[i], "rb"))) { srclen = bf_readfile(0, &src, fh); fclose(fh); }
+        if (!src) { printf("//unable to open file [%s]\n", paths[i]); rc = -1; continue; }
+        if (!(sg[i].program = bf_Program_compile(src, srclen, 0, 0))) {
+            printf("//unable to compile [%s]\n", paths[i]);
+            rc = -1;
+        }
+#if !defined(_WIN32)
+        if (mapped) { munmap(src, mapped); src = 0; }
+#endif
+        free(src);
+    }
+    for (i = 0; rc == 0 && i < n - 1; i++) {
+        if (!(rings[i].buf = (char*)malloc(BF_RING))) { rc = -1; break; }
+        bf_mutexInit(&rings[i].lock);
+        bf_condInit(&rings[i].wake);
+        sg[i].out = sg[i + 1].in = &rings[i];
+    }
+
+    if (rc == 0) {
+        if (streams) {
+            fflush(stdout);
+            if (bf_Stream_open(&sin, 0, 0) >= 0)  sg[0].sin = &sin;
+            if (bf_Stream_open(&sout, 1, 1) >= 0) sg[n - 1].sout = &sout;
+        }
+        for (i = 0; i < n; i++)
+            if (!(sg[i].started = bf_threadStart(&sg[i].thread, bf_stageRun, &sg[i]))) {
+                if (sg[i].in)  bf_ringClose(sg[i].in, &sg[i].in->gone);    // as if it ended at once
+                if (sg[i].out) bf_ringClose(sg[i].out, &sg[i].out->closed);
+            }
+        for (i = 0; i < n; i++) if (sg[i].started) bf_threadJoin(sg[i].thread);
+        if (sg[0].sin)      bf_Stream_close(&sin);
+        if (sg[n - 1].sout) bf_Stream_close(&sout);
+        for (i = 0; i < n; i++) {
+            if (!sg[i].started) { printf("//unable to start stage %d [%s]\n", i, paths[i]); rc = -1; }
+            else if (sg[i].st == bf_EVAL_ERROR) printf("// memory exception [%s]\n", paths[i]);
+        }
+        for (i = 0; i < n - 1; i++) moved += (size_t)rings[i].head;
+        if (metric) {
+            t = bf_now() - t;
+            for (i = 0; i < n; i++) printf("//-- stage %d: %.3f s [%s]\n", i, sg[i].secs, paths[i]);
+            printf("//-- pipeline: %d stages: %.3f s, %.1f MB between stages, %.1f MB/s\n",
+                   n, t, (double)moved / 1e6, t > 0 ? (double)moved / t / 1e6 : 0.0);
+        }
+    }
+
+    for (i = 0; i < n - 1; i++) {
+        if (!rings[i].buf) continue;
+        free(rings[i].buf);
+        bf_mutexFree(&rings[i].lock);
+        bf_condFree(&rings[i].wake);
+    }
+    for (i = 0; i < n; i++) bf_Program_release(sg[i].program);
+    free(rings);
+    free(sg);
+    return rc;
+}
+
+// =====================================================================
+// main
+// =====================================================================
+int bffsree_Main(int argc, char* argv[]) {
+    int carg = 0, printBF = 0, metric = 0, i;
+    char* src = 0;
+    size_t srclen = 0, mapped = 0;
+    const char *profOut = 0, *profIn = 0;
+    int sparse = 0, huge = 0, streams = 0, rc = 0, st;
+    const char* batch = 0;
+    int jobs = 0, lanes = 0, pipeline = 0, stages = 0;
+#if BF_NGRAMS
+    const char* ngramOut = 0;
+#endif
+    bf_Profile prof = {0, 0, 0};
+    bf_Arena arena = {0, 0, 0, 0};  // IR and compile scratch (and the source, when read)
+    bf_OptOptions opt = {0, 0, &arena};
+    bf_VM vm;
+    bf_Stream sin, sout;
+    FILE* fh = 0;
+
+    // options
+    for (i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "-c") == 0)      printBF = 1;
+        else if (strcmp(argv[i], "-j") == 0 && i + 1 < argc && argv[i + 1][0] &&
+                 strspn(argv[i + 1], "0123456789") == strlen(argv[i + 1]))  jobs = atoi(argv[++i]);
+        else if (strcmp(argv[i], "-j") == 0) printBF = 2;
+        else if (strcmp(argv[i], "-m") == 0) metric = 1;
+        else if (strcmp(argv[i], "-S") == 0) sparse = 1;
+        else if (strcmp(argv[i], "-H") == 0) huge = 1;
+        else if (strcmp(argv[i], "-U") == 0) streams = 1;
+        else if (strcmp(argv[i], "-P") == 0 && i + 1 < argc)            profOut = argv[++i];
+        else if (strcmp(argv[i], "--use-profile") == 0 && i + 1 < argc) profIn  = argv[++i];
+        else if (strcmp(argv[i], "--batch") == 0 && i + 1 < argc)       batch   = argv[++i];
+        else if (strcmp(argv[i], "--lanes") == 0 && i + 1 < argc)       lanes   = atoi(argv[++i]);
+        else if (strcmp(argv[i], "--pipeline") == 0) {   // the programs up to the next option
+            for (pipeline = i + 1; i + 1 < argc && argv[i + 1][0] != '-'; i++);
+            stages = i + 1 - pipeline;
+        }
+#if BF_NGRAMS
+        else if (strcmp(argv[i], "-N") == 0 && i + 1 < argc)            ngramOut = argv[++i];
+        else if (strcmp(argv[i], "--gen-super") == 0 && i + 1 < argc)   return bf_ngramGenSuper(argv[i + 1], stdout);
+#endif
+        else if (carg == 0) carg = i;
+    }
+
+    if (batch) return bf_batch(batch, jobs > 0 ? jobs : bf_cpuCount());
+    if (lanes > 0) {
+        if (!carg) { printf("//--lanes needs a program file\n"); return -1; }
+        return bf_lanes(argv[carg], lanes, metric);
+    }
+    if (pipeline) {
+        if (stages < 1) { printf("//--pipeline needs program files\n"); return -1; }
+        return bf_pipeline(argv + pipeline, stages, streams, metric);
+    }
+
+    if (profIn && bf_Profile_load(&prof, profIn) != 0) {
+        printf("//unable to read profile [%s]\n", profIn);
+        profIn = 0;
+    }
+    arena.huge = huge;
+    if (profOut)     { opt.flags |= bf_OPT_PROFILE; opt.profile = &prof; }
+    else if (profIn) { opt.profile = &prof; }
+
+    // read program: a file is mapped and compiled in place, the input
+    // after its '!' is run from there too
+    if (carg) {
+        srclen = mapped = bf_mapfile(&src, argv[carg]);
+        if (!src) {
+            fh = fopen(argv[carg], "r");
+            if (fh == 0) { printf("//unable to open file [%s]\n", argv[carg]); return -1; }
+        }
+    } else {
+        fh = stdin;
+    }
+    if (!src) srclen = bf_readfile(&arena, &src, fh);
+    if (fh && fh != stdin) fclose(fh);
+
+    // run
+    bf_VM_alloc(&vm);
+    if (sparse) bf_VM_tapeReserve(&vm, BF_TAPE_SPARSE_RESERVE, bf_TAPE_SPARSE);
+    else        bf_VM_tapeReserve(&vm, BF_TAPE_RESERVE, huge ? bf_TAPE_HUGE : 0);
+    vm.profile = &prof;
+    if (bf_VM_compile(&vm, src, srclen, metric, &opt) < 0) rc = -1;
+    else if (printBF == 2)   bffsree_Print(&vm, 0, 0);
+    else if (printBF == 1)   bffsree_Print(&vm, 0, 1);
+    else {
+        if (streams) {  // stdin/stdout through bf_Stream (io_uring where there is one)
+            fflush(stdout);
+            if (bf_Stream_open(&sout, 1, 1) >= 0) { vm.writep = bf_Stream_write; vm.writedata = &sout; }
+            if (bf_Stream_open(&sin, 0, 0) >= 0)  { vm.readp  = bf_Stream_read;  vm.readdata  = &sin; }
+        }
+        do {
+            st = bffsree_Eval(&vm, 0, 10000);
+        } while (st == bf_EVAL_BUDGET);
+        if (vm.writep) bf_Stream_close(&sout);
+        if (vm.readp)  bf_Stream_close(&sin);
+        if (st == bf_EVAL_ERROR) printf("// memory exception\n");
+        if (metric) {
+            printf("//-- Tape: %ld KB resident of %ld KB reserved\n", bf_VM_tapeResident(&vm) / 1024,
+                   (long)((size_t)vm.tapeLen * sizeof(bf_cell) / 1024));
+            printf("//-- Arena: %ld KB peak\n", (long)(arena.peak / 1024));
+            if (huge) {
+                long ht = vm.tapeMapped ? bf_hugeResident(vm.tape + vm.tapeOrigin) : -1;
+                long hp = bf_hugeResident(vm.prog_op);
+                printf("//-- Huge pages: %ld KB of tape, %ld KB of IR (-1: unknown)\n",
+                       ht < 0 ? -1 : ht / 1024, hp < 0 ? -1 : hp / 1024);
+            }
+        }
+        if (profOut && bf_Profile_save(&prof, profOut) != 0)
+            printf("//unable to write profile [%s]\n", profOut);
+#if BF_NGRAMS
+        if (ngramOut && bf_ngramSave(ngramOut) != 0)
+            printf("//unable to write n-gram counts [%s]\n", ngramOut);
+#endif
+    }
+    bf_VM_free(&vm);
+    bf_Arena_free(&arena);
+    bf_Profile_free(&prof);
+#if !defined(_WIN32)
+    if (mapped) munmap(src, mapped);
+#endif
+
+    // done
+    return rc;
+}
+
 #endif // BFFSREE_IMPLEMENTATION
@@ -5,9 +5,39 @@
 #define _BFF_SREE_H_
 
 #include <stdint.h>
+#include <limits.h>
 #include <stdlib.h>
 #include <string.h>
 #include <stdio.h>
+#include <errno.h>
+#if defined(_WIN32)
+#include <windows.h>
+#include <io.h>
+#else
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <poll.h>
+#include <time.h>
+#endif
+
+// io_uring behind bf_Stream (Linux with the kernel headers); 0: plain read/write
+#ifndef BF_URING
+#if defined(__linux__) && defined(__has_include)
+#if __has_include(<linux/io_uring.h>)
+#define BF_URING 1
+#endif
+#endif
+#endif
+#ifndef BF_URING
+#define BF_URING 0
+#endif
+#if BF_URING
+#include <linux/io_uring.h>
+#include <sys/syscall.h>
+#endif
 
 // -----------------------------
 // Configuration (compile-time)
@@ -76,34 +106,246 @@ typedef int16_t bf_off_t;
 #define BF_OPT_LOOP_RUNAWAY 65536
 #endif
 
+// Loop is "hot" (worth expensive transforms) once entries + iterations reach this.
+#ifndef BF_PROF_HOT
+#define BF_PROF_HOT 64
+#endif
+
+// Instrumented build: count executed op pairs/triples for `make super`.
+#ifndef BF_NGRAMS
+#define BF_NGRAMS 0
+#endif
+
+// Cells the command line reserves for the tape (address space only; pages
+// are committed on first touch). Execution starts in the middle.
+#ifndef BF_TAPE_RESERVE
+#define BF_TAPE_RESERVE (1 << 28)
+#endif
+// Cells `-S` reserves: half the int range, so sp plus an op offset (or a
+// window end) never overflows.
+#ifndef BF_TAPE_SPARSE_RESERVE
+#define BF_TAPE_SPARSE_RESERVE (1 << 30)
+#endif
+
+// Transparent huge page size (x86-64, and arm64 with 4KB pages).
+#ifndef BF_HUGE_PAGE
+#define BF_HUGE_PAGE (2 << 20)
+#endif
+
+// Output bytes a VM collects before handing them to its sink.
+#ifndef BF_OUTBUF
+#define BF_OUTBUF 4096
+#endif
+
+// Input bytes a VM asks its source for at a time.
+#ifndef BF_INBUF
+#define BF_INBUF 4096
+#endif
+
+// Bytes in each of a bf_Stream's two buffers.
+#ifndef BF_STREAM_BUF
+#define BF_STREAM_BUF (256 * 1024)
+#endif
+
+// Bytes in the ring between two --pipeline stages (a power of two).
+#ifndef BF_RING
+#define BF_RING (64 * 1024)
+#endif
+
+// Reset VMs bf_VM_release keeps per thread.
+#ifndef BF_VM_POOL
+#define BF_VM_POOL 8
+#endif
+
+// Bytes an arena takes from malloc at a time (bigger requests get their own block).
+#ifndef BF_ARENA_CHUNK
+#define BF_ARENA_CHUNK (64 * 1024)
+#endif
+
+// Superinstructions `make super` keeps.
+#ifndef BF_SUPER_MAX
+#define BF_SUPER_MAX 16
+#endif
+
 typedef int (*bf_putcharProc)(void* data, int ch);
 typedef int (*bf_getcharProc)(void* data);
+typedef int (*bf_writeProc)(void* data, const char* buf, size_t n);   // bytes taken
+typedef int (*bf_readProc)(void* data, char* buf, size_t n);   // bytes read, 0 at EOF
+
+// from a readProc or getcharProc: no input yet, the ',' suspends bffsree_Eval
+#define BF_AGAIN (-2)
+
+// -----------------------------
+// Loop profile (indexed by source '[' ordinal)
+// -----------------------------
+typedef struct bf_loopProf {
+    uint64_t entries;   // times the loop was reached
+    uint64_t iters;     // times the body ran
+} bf_loopProf;
+
+typedef struct bf_Profile {
+    uint32_t     hash;      // hash of the program's BF commands
+    int          loopCount;
+    bf_loopProf* loops;
+} bf_Profile;
+
+// -----------------------------
+// Arena: bump allocator for one program's compile artifacts
+// -----------------------------
+typedef struct bf_ArenaBlock {
+    struct bf_ArenaBlock* next;
+    size_t size, used;          // data follows the header
+    int    mapped;              // from bf_mapHuge (munmap), else malloc
+} bf_ArenaBlock;
+
+typedef struct bf_Arena {
+    bf_ArenaBlock* head;        // bump block; big allocations sit behind it
+    size_t bytes, peak;         // taken from malloc now / at most
+    int    huge;                // blocks of BF_HUGE_PAGE / 2 and up go on huge pages
+} bf_Arena;
+
+// -----------------------------
+// Stream: a file descriptor behind writep/readp, double-buffered. One buffer
+// fills (or is read from) while io_uring writes (or reads ahead) the other;
+// without io_uring the buffers go through plain write/read.
+// -----------------------------
+typedef struct bf_Stream {
+    int      fd, out;           // out: written to, else read from
+    int      ring;              // io_uring fd, -1: plain read/write
+    int      cur, busy;         // buffer in use; the other is in flight
+    char*    buf[2];
+    size_t   len[2];            // bytes held (out) or read (in)
+    size_t   pos;               // in: next byte of buf[cur]
+    void     *sq, *cq, *sqes;   // ring mappings
+    size_t   sqSize, cqSize;
+    unsigned *sqTail, *sqMask, *sqArray, *cqHead, *cqTail, *cqMask;
+    void*    cqes;
+} bf_Stream;
+
+// -----------------------------
+// Scheduler task: a VM run in turns on a bf_Sched's threads (caller-owned)
+// -----------------------------
+typedef struct bf_Task {
+    struct bf_VM* vm;           // compiled, sinks set
+    int         weight;         // turn length in slices (0: 1)
+    long long   fuel;           // budget units it may use in all, 0: no limit
+    int         fdIn, fdOut;    // behind readp/writep, polled when the VM suspends
+                                //   on them (-1: wait for bf_Sched_wake)
+    void      (*done)(struct bf_Task* t);   // on a worker thread, once st is final
+    void*       user;
+    int         st;             // bf_EVAL_ status; bf_EVAL_BUDGET when done: out of fuel
+
+    struct bf_Task*  next;      // scheduler's: run queue or poll list
+    struct bf_Sched* sched;
+    int         state, woken;
+    int         pollFd;
+    short       pollEv;
+} bf_Task;
+
+typedef struct bf_Sched bf_Sched;
+
+// -----------------------------
+// Optimizer options
+// -----------------------------
+enum {
+    bf_OPT_PROFILE = 1,     // record: emit bfo_PROF counters into profile
+    bf_OPT_LANES   = 2,     // per-cell ops only, for bf_Lanes: no bulk, walk or divmod ops, no superinstructions
+};
+
+typedef struct bf_OptOptions {
+    int         flags;
+    bf_Profile* profile;    // record target (bf_OPT_PROFILE) or hotness source
+    bf_Arena*   arena;      // IR and scratch come from here (0: malloc)
+} bf_OptOptions;
 
 // -----------------------------
 // VM structures
 // -----------------------------
 typedef struct bf_VM_help { int v; } bf_VM_help;
 
+// a compiled program: read-only once built, so any number of VMs (on any
+// threads) can run it at once; each bf_VM_load takes a reference
+typedef struct bf_Program {
+    int         refs;
+    char*       prog;           // as in bf_VM
+    int         progLen;
+    bf_VM_help* progHelper;
+    void*       prog_op;
+    int         progLen_op;
+    int         reach;          // as in bf_VM
+    const char* input;          // what followed the '!', if anything
+    size_t      inputLen;
+    bf_Arena    arena;          // holds all of the above
+} bf_Program;
+
 typedef struct bf_VM {
     int pc, sp;
 
     bf_cell*    tape;
     int         tapeLen;
+    int         tapeMapped; // tape comes from bf_VM_tapeReserve
+    int         tapeOrigin; // sp a fresh run starts at
+    int         touchLo;    // cells sp has reached (empty while touchHi < touchLo);
+    int         touchHi;    //   bf_VM_reset clears this range plus the program's reach
     char*       prog;
     int         progLen;
     bf_VM_help* progHelper;
 
-    bf_getcharProc  getcp;
+    bf_getcharProc  getcp;      // per-byte source, used when readp is 0
     void*           getdata;
-    bf_putcharProc  putcp;
+    bf_readProc     readp;      // input source, refills inPos..inEnd in bulk
+    void*           readdata;
+    bf_putcharProc  putcp;      // per-byte sink, used when writep is 0
     void*           putdata;
+    bf_writeProc    writep;     // output sink, gets whole buffers
+    void*           writedata;
 
     void*   prog_op;
     int     progLen_op;
+    int     reach;          // widest bf_opReach: Eval keeps sp this far in from both ends of the tape
 
     void*   debugProg;
+    bf_Arena*   arena;      // holds prog, progHelper and prog_op (not owned, never freed by the VM)
+    bf_Program* program;    // or this does (bf_VM_load; released with the program)
+    bf_Profile* profile;    // counters for bfo_PROF (not owned)
+
+    int         outLen;     // output a sink has not taken yet (bf_VM_reset drops it)
+    char        out[BF_OUTBUF];
+
+    const char* inPos;      // input not yet read: an embedded span (bf_VM_input)
+    const char* inEnd;      //   or the last refill of inBuf
+    char        inBuf[BF_INBUF];
 } bf_VM;
 
+// -----------------------------
+// Lanes: one program in lockstep over many inputs. Cell c of lane l is
+// tape[c * n + l], so while every lane is on the same cell (uni) an op is
+// one loop over adjacent cells; lanes that leave a loop early wait with
+// their mask off until the rest do.
+// -----------------------------
+typedef struct bf_Lane {
+    int         st;             // bf_EVAL_BUDGET while it runs, then EOP or ERROR
+    const char* inPos;          // input not yet read; EOF after it
+    const char* inEnd;
+    char*       out;            // everything the lane printed
+    size_t      outLen, outCap;
+} bf_Lane;
+
+typedef struct bf_Lanes {
+    int         n, cells;       // lanes, tape cells per lane
+    bf_cell*    tape;
+    int*        sp;             // per lane, while uni is 0
+    uint8_t*    on;             // lane runs the current op
+    uint8_t*    masks;          // per open loop: the lanes that entered it
+    uint8_t*    full;           //   or, if set, all of them
+    int         depth, maxDepth;
+    int         uni, usp;       // every lane on and at cell usp
+    int         pc;
+    bf_Program* program;
+    bf_Lane*    lane;
+    long long   uniOps, laneOps;    // ops run on all lanes at once / lane by lane
+} bf_Lanes;
+
 // -----------------------------
 // BF tokens
 // -----------------------------
@@ -138,6 +380,22 @@ enum ebfo_CMD {
     bfo_VAL_MZ,
     bfo_VAL_MUL,
     bfo_VAL_ZERO,
+    bfo_PROF,
+    bfo_MEM_SET,
+    bfo_MEM_MOVE,
+    bfo_ZERO_S,
+    bfo_MOVE_S,
+    bfo_DIVMOD,
+    bfo_VAL_IF,
+    bfo_ADD_S,
+    bfo_MEM_VEC,
+    bfo_MUL_VEC,
+    // fused superinstructions, regenerated by `make super`
+#define BF_SUPER2(a, za, b)         bfo_S2_##a##_##za##_##b,
+#define BF_SUPER3(a, za, b, zb, c)  bfo_S3_##a##_##za##_##b##_##zb##_##c,
+#include "bffsree-super.h"
+#undef BF_SUPER2
+#undef BF_SUPER3
     bfo_DEBUG,
     bfo_EOP,
     bfo_Total
@@ -147,6 +405,7 @@ typedef struct bf_op {
     uint8_t     cmd;
     bf_op_buf_t buf;   // IR argument: loop-inline delta OR target offset
     bf_off_t    off;   // pointer delta after op
+    bf_off_t    arg;   // bulk/scan ops: cell count or stride (fits the padding)
     int32_t     val;   // jump distance, immediate value, multiplier
 } bf_op;
 
@@ -155,32 +414,126 @@ typedef struct bf_op {
 // -----------------------------
 #define _myfree(a)            do{ if(a){ free(a); (a)=0; } }while(0)
 #define _myabs(a)             (((a)<0)?-(a):(a))
+#define _mymin(a,b)           (((a)<(b))?(a):(b))
+#define _mymax(a,b)           (((a)>(b))?(a):(b))
 #define _myresize(a,b,i)      do{ if((i)>(b)){ (b)=((i)>(b))?(i):((b)?(b)*2:64); (a)=(a)?realloc((a),(b)*sizeof(*(a))):malloc((b)*sizeof(*(a))); } }while(0)
+// same, from arena r (0: realloc); doubles, as an arena can't take back a moved block
+#define _myaresize(r,a,b,i)   do{ if((i)>(b)){ size_t _o=(b)*sizeof(*(a)); (b)=_mymax((i),(b)?(b)*2:64); (a)=bf_Arena_grow((r),(a),_o,(b)*sizeof(*(a))); } }while(0)
 #define _mybounds(a,b)        ((unsigned long)(a)>=(unsigned long)(b))
 
+#if defined(_MSC_VER)
+#define BF_RESTRICT __restrict
+#define BF_THREAD_LOCAL __declspec(thread)
+#define bf_atomicInc(p) InterlockedIncrement((volatile LONG*)(p))
+#define bf_atomicDec(p) InterlockedDecrement((volatile LONG*)(p))
+#define bf_atomicLoad(p) InterlockedCompareExchange((volatile LONG*)(p), 0, 0)
+#else
+#define BF_RESTRICT __restrict__
+#define BF_THREAD_LOCAL __thread
+#define bf_atomicInc(p) __atomic_add_fetch((p), 1, __ATOMIC_RELAXED)
+#define bf_atomicDec(p) __atomic_sub_fetch((p), 1, __ATOMIC_ACQ_REL)
+#define bf_atomicLoad(p) __atomic_load_n((p), __ATOMIC_ACQUIRE)
+#endif
+
 // -----------------------------
 // VM API (header-only like original)
 // -----------------------------
-static int bf_putc(void* f, int c) { (void)f; return putchar(c); }
-static int bf_getc(void* f)        { return f ? getc((FILE*)f) : getchar(); }
+// the FILE* in putdata/getdata (0: stdout/stdin)
+static int bf_putc(void* f, int c) { return putc(c, f ? (FILE*)f : stdout); }
+static int bf_getc(void* f)        { return getc(f ? (FILE*)f : stdin); }
+
+#if defined(_WIN32)
+#define bf_flockfile        _lock_file
+#define bf_funlockfile      _unlock_file
+#define bf_getc_unlocked    _getc_nolock
+#else
+#define bf_flockfile        flockfile
+#define bf_funlockfile      funlockfile
+#define bf_getc_unlocked    getc_unlocked
+#endif
+
+// bulk version of bf_getc: up to a newline (all a terminal hands over at
+// once, so an interactive program isn't kept waiting) or n bytes
+static int bf_read(void* f, char* buf, size_t n) {
+    FILE* fh = f ? (FILE*)f : stdin;
+    size_t k = 0;
+    int c;
+
+    bf_flockfile(fh);
+    while (k < n && (c = bf_getc_unlocked(fh)) != EOF) {
+        buf[k++] = (char)c;
+        if (c == '\n') break;
+    }
+    bf_funlockfile(fh);
+    return (int)k;
+}
+
+// hands buffered output to the sink: writep, else putcp byte by byte
+// (the FILE* default in one fwrite). Returns the bytes a writep that took
+// only part of it (a non-blocking sink) left behind.
+static int bf_VM_flush(bf_VM* bp) {
+    int i;
+    if (bp->outLen == 0) return 0;
+    if (bp->writep) {
+        i = bp->writep(bp->writedata, bp->out, (size_t)bp->outLen);
+        if (i < 0) i = 0;
+        if (i < bp->outLen) {
+            memmove(bp->out, bp->out + i, (size_t)(bp->outLen - i));
+            return bp->outLen -= i;
+        }
+    }
+    else if (bp->putcp == bf_putc) fwrite(bp->out, 1, (size_t)bp->outLen, bp->putdata ? (FILE*)bp->putdata : stdout);
+    else for (i = 0; i < bp->outLen; i++) bp->putcp(bp->putdata, (unsigned char)bp->out[i]);
+    bp->outLen = 0;
+    return 0;
+}
+
+// GET with the input span used up: refills it from readp, else from getcp
+// (a byte at a time; the stdin default in bulk). Prompts the program wrote
+// go out first. Returns the next byte or EOF.
+static int bf_VM_read(bf_VM* bp) {
+    int n;
+    bf_VM_flush(bp);
+    if (bp->readp)                 n = bp->readp(bp->readdata, bp->inBuf, BF_INBUF);
+    else if (bp->getcp == bf_getc) n = bf_read(bp->getdata, bp->inBuf, BF_INBUF);
+    else                           return bp->getcp(bp->getdata);
+    if (n == BF_AGAIN) return BF_AGAIN;
+    if (n <= 0) return EOF;
+    bp->inPos = bp->inBuf;
+    bp->inEnd = bp->inBuf + n;
+    return (unsigned char)*bp->inPos++;
+}
+
+// input to read before the source: n bytes at p, NULs included. The VM
+// reads them in place; they must stay put until used.
+static void bf_VM_input(bf_VM* bp, const char* p, size_t n) {
+    bp->inPos = p;
+    bp->inEnd = p + n;
+}
 
 static int bf_VM_alloc(bf_VM* bp) {
     memset(bp, 0, sizeof(*bp));
     bp->getcp = bf_getc;
     bp->putcp = bf_putc;
+    bp->touchHi = -1;
     return 0;
 }
 
-static int bf_VM_free(bf_VM* bp) {
-    _myfree(bp->prog);
-    _myfree(bp->tape);
-    _myfree(bp->prog_op);
-    _myfree(bp->debugProg);
-    _myfree(bp->progHelper);
-    return 0;
+// unmaps a reserved tape; the kernel hands back its touched pages
+static void bf_VM_tapeUnmap(bf_VM* bp) {
+#if defined(_WIN32)
+    VirtualFree(bp->tape, 0, MEM_RELEASE);
+#else
+    munmap(bp->tape, (size_t)bp->tapeLen * sizeof(bf_cell));
+#endif
+    bp->tape = 0;
+    bp->tapeMapped = 0;
+    bp->tapeOrigin = 0;
+    bp->touchHi = bp->touchLo - 1;
 }
 
 static int bf_VM_tape(bf_VM* bp, int len) {
+    if (bp->tapeMapped) { bf_VM_tapeUnmap(bp); bp->tapeLen = 0; }
     if (len) {
         if (bp->tape && bp->tapeLen == len) return 0;
         bp->tape = bp->tape ? (bf_cell*)realloc(bp->tape, (size_t)len * sizeof(bf_cell))
@@ -190,21 +543,211 @@ static int bf_VM_tape(bf_VM* bp, int len) {
             memset(bp->tape + bp->tapeLen, 0, (size_t)(len - bp->tapeLen) * sizeof(bf_cell));
         }
         bp->tapeLen = len;
+        if (bp->touchHi >= len) bp->touchHi = len - 1;
     } else {
         _myfree(bp->tape);
         bp->tapeLen = 0;
+        bp->touchHi = bp->touchLo - 1;
+    }
+    return 0;
+}
+
+enum {
+    bf_TAPE_SPARSE = 1,     // bf_VM_tapeReserve: small pages only (cells far apart)
+    bf_TAPE_HUGE   = 2,     //   transparent huge pages (long scans of a big tape)
+};
+
+// maps n bytes starting on a BF_HUGE_PAGE boundary and asks for transparent
+// huge pages (the kernel may still say no); munmap(p, n) releases it.
+// 0 where there is no THP.
+static void* bf_mapHuge(size_t n, int noreserve) {
+#if defined(MADV_HUGEPAGE)
+    size_t h = BF_HUGE_PAGE, a, e, end;
+    char* p = (char*)mmap(0, n + h, PROT_READ | PROT_WRITE,
+                          MAP_PRIVATE | MAP_ANONYMOUS | (noreserve ? MAP_NORESERVE : 0), -1, 0);
+    if (p == MAP_FAILED) return 0;
+    a   = ((size_t)p + h - 1) & ~(h - 1);
+    e   = (a + n + 4095) & ~(size_t)4095;
+    end = (size_t)p + n + h;
+    if (a > (size_t)p) munmap(p, a - (size_t)p);
+    if (end > e)       munmap((void*)e, end - e);
+    if (madvise((void*)a, n, MADV_HUGEPAGE) != 0) { munmap((void*)a, n); return 0; }
+    return (void*)a;
+#else
+    (void)n; (void)noreserve;
+    return 0;
+#endif
+}
+
+// reserves len cells of address space for the tape and starts sp in the
+// middle, so programs can walk either way; zero pages are only committed
+// when touched (Windows commits the whole range up front, which costs commit
+// charge but no memory until touched). Falls back to a malloc'd bf_MAXCELLS tape.
+static int bf_VM_tapeReserve(bf_VM* bp, int len, int flags) {
+    size_t bytes = (size_t)len * sizeof(bf_cell);
+    void* p;
+
+    bf_VM_tape(bp, 0);
+#if defined(_WIN32)
+    p = VirtualAlloc(0, bytes, MEM_RESERVE | MEM_COMMIT, PAGE_READWRITE);
+#else
+    p = (flags & bf_TAPE_HUGE) && !(flags & bf_TAPE_SPARSE) ? bf_mapHuge(bytes, 1) : 0;
+    if (!p) p = mmap(0, bytes, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+    if (p == MAP_FAILED) p = 0;
+#if defined(MADV_NOHUGEPAGE)
+    // a huge page would commit 2MB around every far-off cell
+    if (p && (flags & bf_TAPE_SPARSE)) madvise(p, bytes, MADV_NOHUGEPAGE);
+#endif
+#endif
+    (void)flags;
+    if (!p) {
+        bp->sp = bp->tapeOrigin = 0;
+        return bf_VM_tape(bp, bf_MAXCELLS);
     }
+    bp->tape       = (bf_cell*)p;
+    bp->tapeLen    = len;
+    bp->tapeMapped = 1;
+    bp->sp = bp->tapeOrigin = len / 2;
+    return 0;
+}
+
+// bytes of tape backed by memory (-1 if the platform can't tell)
+static long bf_VM_tapeResident(const bf_VM* bp) {
+#if defined(__linux__)
+    size_t page = 4096, n, i;
+    unsigned char* vec;
+    long r = 0;
+
+    if (!bp->tapeMapped) return (long)((size_t)bp->tapeLen * sizeof(bf_cell));
+    n = ((size_t)bp->tapeLen * sizeof(bf_cell) + page - 1) / page;
+    if (!(vec = (unsigned char*)malloc(n))) return -1;
+    if (mincore(bp->tape, (size_t)bp->tapeLen * sizeof(bf_cell), vec) == 0)
+        for (i = 0; i < n; i++) r += (vec[i] & 1) ? (long)page : 0;
+    else
+        r = -1;
+    free(vec);
+    return r;
+#else
+    (void)bp;
+    return -1;
+#endif
+}
+
+void bf_Program_release(bf_Program* p);
+
+static void bf_VM_dropProg(bf_VM* bp) {
+    _myfree(bp->debugProg);
+    if (bp->program || bp->arena) {
+        if (bp->program) bf_Program_release(bp->program);
+        bp->program = 0;
+        bp->prog = 0; bp->prog_op = 0; bp->progHelper = 0;
+    } else {
+        _myfree(bp->prog);
+        _myfree(bp->prog_op);
+        _myfree(bp->progHelper);
+    }
+}
+
+static int bf_VM_free(bf_VM* bp) {
+    bf_VM_dropProg(bp);
+    bf_VM_tape(bp, 0);
     return 0;
 }
 
 // -----------------------------
 // Public API
 // -----------------------------
+// bffsree_Eval results; the VM resumes where it stopped on the next call
+enum {
+    bf_EVAL_EOP = 0,        // program ended (vm->pc is -1)
+    bf_EVAL_BUDGET,         // icount used up
+    bf_EVAL_INPUT,          // a ',' got BF_AGAIN: feed bf_VM_input or wait for readp
+    bf_EVAL_OUTPUT,         // a '.' found the buffer full and the sink took none of it
+    bf_EVAL_ERROR,          // memory exception, or no program
+};
+
 int  bffsree_Main(int argc, char* argv[]);
+// runs up to icount ops (a debug build), or loop iterations (release), and
+// returns a bf_EVAL_ status; inp (NUL-terminated, may be 0) is the input on
+// a VM that has none yet -- bf_VM_input takes any bytes
 int  bffsree_Eval(bf_VM* vm, char* inp, int icount);
 void bffsree_Print(bf_VM* vm, char* inp, int lang);
+const char* bf_opName(int cmd);
+
+// Arena: alloc/grow come from the arena, or malloc/realloc when it is 0;
+// reset frees everything in one go but keeps a block for the next program
+void* bf_Arena_alloc(bf_Arena* ar, size_t n);
+void* bf_Arena_grow(bf_Arena* ar, void* p, size_t old, size_t n);
+void  bf_Arena_release(bf_Arena* ar, void* p, size_t n);
+void  bf_Arena_reset(bf_Arena* ar);
+void  bf_Arena_free(bf_Arena* ar);
+
+// bytes of the mapping holding p that sit on transparent huge pages (-1: unknown)
+long bf_hugeResident(const void* p);
+
+// VM reuse: reset drops the program and clears only the cells the last run
+// could have touched; acquire/release keep up to BF_VM_POOL reset VMs per
+// thread (drain frees the calling thread's pool)
+int  bf_VM_reset(bf_VM* vm);
+bf_VM* bf_VM_acquire(void);
+void bf_VM_release(bf_VM* vm);
+void bf_VM_poolDrain(void);
+
+// readp/writep for a file descriptor (data: the fd, cast); on a non-blocking
+// one bffsree_Eval returns bf_EVAL_INPUT/bf_EVAL_OUTPUT instead of waiting
+int  bf_readFd(void* fd, char* buf, size_t n);
+int  bf_writeFd(void* fd, const char* buf, size_t n);
+
+// streams: open gives 0 with io_uring, 1 with plain read/write, -1 if out of
+// memory; bf_Stream_write/read are the writep/readp (data: the stream), and
+// close hands on what is still buffered. Blocking fds only.
+int  bf_Stream_open(bf_Stream* s, int fd, int out);
+int  bf_Stream_write(void* s, const char* buf, size_t n);
+int  bf_Stream_read(void* s, char* buf, size_t n);
+void bf_Stream_close(bf_Stream* s);
+
+// scheduler: tasks on `workers` threads (0: one per CPU), each turn
+// `slice` budget units (0: 10000) times the task's weight, round robin with
+// idle threads stealing. spawn queues t, which must live until t->done ran;
+// a task that suspends on I/O sleeps until its fd is ready, or until
+// bf_Sched_wake if it has none. wait: until all spawned tasks are done
+bf_Sched* bf_Sched_create(int workers, int slice);
+int  bf_Sched_spawn(bf_Sched* s, bf_Task* t);
+void bf_Sched_wake(bf_Task* t);
+void bf_Sched_wait(bf_Sched* s);
+void bf_Sched_destroy(bf_Sched* s);
+
+// lanes: n runs of p (compiled with bf_OPT_LANES) in lockstep, each with a
+// tape of `cells` cells (starting in the middle) and its own input span,
+// which must outlive the run. run goes on for up to icount taken back-edges:
+// bf_EVAL_BUDGET while a lane is still running, else bf_EVAL_EOP (ERROR: out
+// of memory); the lanes' own statuses and output are in ln->lane. -1 from
+// init: not a lanes program, or out of memory
+int  bf_Lanes_init(bf_Lanes* ln, bf_Program* p, int n, int cells);
+void bf_Lanes_input(bf_Lanes* ln, int lane, const char* in, size_t len);
+int  bf_Lanes_run(bf_Lanes* ln, int icount);
+void bf_Lanes_free(bf_Lanes* ln);
+
+// compiles src[0..len) up to a NUL or '!' (what follows the '!' becomes
+// the input of a VM that has none); the IR comes from opt's arena, if any.
+// Returns the IR length, -1 on error (unbalanced brackets)
+int  bf_VM_compile(bf_VM* vm, const char* src, size_t len, int printMetrics, const bf_OptOptions* opt);
+
+// the same, once for many VMs: the program owns its IR and a copy of the
+// input (opt's arena is not used), and lives while a reference does.
+// bf_VM_load drops the VM's program for p (the input too, if it has none);
+// a bf_OPT_PROFILE program needs vm->profile set on every VM running it
+bf_Program* bf_Program_compile(const char* src, size_t len, int printMetrics, const bf_OptOptions* opt);
+bf_Program* bf_Program_retain(bf_Program* p);
+void bf_Program_release(bf_Program* p);
+int  bf_VM_load(bf_VM* vm, bf_Program* p);
+
+int  bf_Optimize(void** bfoptr, const char* chars, int proglen, int printMetrics);
+int  bf_OptimizeEx(void** bfoptr, const char* chars, int proglen, int printMetrics, const bf_OptOptions* opt);
 
-int  bf_Optimize(void** bfoptr, char* chars, int proglen, int printMetrics);
+int  bf_Profile_load(bf_Profile* prof, const char* path);
+int  bf_Profile_save(const bf_Profile* prof, const char* path);
+void bf_Profile_free(bf_Profile* prof);
 
 #endif // _BF_SREE_H_
 
@@ -0,0 +1,412 @@
+// =====================================================================
+// hosttest.c - embedding tests: the library as a host program drives it
+// (`make hosttest`, run by `make test`; `make hosttest-tsan` for a
+// ThreadSanitizer build)
+// =====================================================================
+
+#define BFFSREE_IMPLEMENTATION
+#define BFFSREE_OPT_IMPLEMENTATION
+
+#include "bffsree.h"
+#include "bffsree.c"
+#include "bffsree-opt.c"
+
+// the command-line driver's IR printer lives in main.c
+void bffsree_Print(bf_VM* vm, char* inp, int lang) { (void)vm; (void)inp; (void)lang; }
+
+static int hostFails;
+
+static void hostCheck(const char* name, int ok) {
+    printf("%-40s [%s]\n", name, ok ? "PASS" : "FAIL");
+    if (!ok) hostFails++;
+}
+
+// output sink: keeps what the VM writes, up to room more bytes (-1: no limit)
+typedef struct hostOut { char* b; size_t n, cap; long room; } hostOut;
+
+static int hostWrite(void* data, const char* buf, size_t n) {
+    hostOut* o = (hostOut*)data;
+    if (o->room >= 0 && (long)n > o->room) n = (size_t)o->room;
+    if (o->room >= 0) o->room -= (long)n;
+    _myresize(o->b, o->cap, o->n + n + 1);
+    memcpy(o->b + o->n, buf, n);
+    o->n += n;
+    return (int)n;
+}
+
+// a sink that is always full
+static int hostRefuse(void* data, const char* buf, size_t n) {
+    (void)data; (void)buf; (void)n;
+    return 0;
+}
+
+// input source: what the host has handed over so far; BF_AGAIN when that
+// is used up, EOF once eof is set
+typedef struct hostIn { const char* p; size_t n; int eof; } hostIn;
+
+static int hostRead(void* data, char* buf, size_t n) {
+    hostIn* in = (hostIn*)data;
+    if (!in->n) return in->eof ? 0 : BF_AGAIN;
+    if (n > in->n) n = in->n;
+    memcpy(buf, in->p, n);
+    in->p += n;
+    in->n -= n;
+    return (int)n;
+}
+
+static void hostSink(bf_VM* vm, hostOut* o) {
+    vm->writep = hostWrite;
+    vm->writedata = o;
+}
+
+// runs vm to its end in turns of icount; the last status
+static int hostRun(bf_VM* vm, int icount) {
+    int st;
+    while ((st = bffsree_Eval(vm, 0, icount)) == bf_EVAL_BUDGET || st == bf_EVAL_OUTPUT) {}
+    return st;
+}
+
+static int hostIs(const hostOut* o, const char* want, size_t n) {
+    return o->n == n && memcmp(o->b, want, n) == 0;
+}
+
+// =====================================================================
+// VM pool: acquire/release hands back a VM whose tape reads as zero
+// =====================================================================
+static void testPool(void) {
+    static const char dirty[] = "+++++[->+>>+++<<<]>>>>-<<<<<-->-";
+    static const char probe[] = "<<<<<.>.>.>.>.>.>.>.>.>.";
+    hostOut o = { 0, 0, 0, -1 };
+    bf_VM *a, *b;
+    char* far;
+    int i, ok = 1, st;
+
+    // a run that dirties cells either side of the origin (and, through a
+    // move loop, past where sp went), then a probe on the same pooled VM
+    a = bf_VM_acquire();
+    bf_VM_compile(a, dirty, strlen(dirty), 0, 0);
+    ok = ok && hostRun(a, 1 << 30) == bf_EVAL_EOP;
+    bf_VM_release(a);
+    b = bf_VM_acquire();
+    hostSink(b, &o);
+    bf_VM_compile(b, probe, strlen(probe), 0, 0);
+    ok = ok && b == a && hostRun(b, 1 << 30) == bf_EVAL_EOP && hostIs(&o, "\0\0\0\0\0\0\0\0\0\0", 10);
+    bf_VM_release(b);
+    hostCheck("pool: reused VM starts on a clean tape", ok);
+
+    // a range big enough to go back to the kernel instead of memset
+    far = (char*)malloc(300000 + 2);
+    for (i = 0; i < 300000; i++) far[i] = '>';
+    strcpy(far + 300000, "+");
+    a = bf_VM_acquire();
+    bf_VM_compile(a, far, strlen(far), 0, 0);
+    st = hostRun(a, 1 << 30);
+    bf_VM_release(a);
+    for (i = 0; i < 300000; i++) far[i] = '>';
+    strcpy(far + 300000, ".");
+    o.n = 0;
+    b = bf_VM_acquire();
+    hostSink(b, &o);
+    bf_VM_compile(b, far, strlen(far), 0, 0);
+    ok = st == bf_EVAL_EOP && hostRun(b, 1 << 30) == bf_EVAL_EOP && hostIs(&o, "\0", 1);
+    bf_VM_release(b);
+    free(far);
+    hostCheck("pool: big touched range is cleared", ok);
+
+    // many rounds through the pool
+    for (i = 0, ok = 1; i < 2000 && ok; i++) {
+        o.n = 0;
+        a = bf_VM_acquire();
+        hostSink(a, &o);
+        bf_VM_compile(a, "++++++++[>++++++++<-]>+.>.", 26, 0, 0);
+        ok = hostRun(a, 1 << 30) == bf_EVAL_EOP && hostIs(&o, "A\0", 2);
+        bf_VM_release(a);
+    }
+    hostCheck("pool: 2000 acquire/run/release rounds", ok);
+    bf_VM_poolDrain();
+    free(o.b);
+}
+
+// =====================================================================
+// Eval budget: a loop that reaches a fresh cell every iteration still
+// yields, and a suspended run's output stays with its owner
+// =====================================================================
+static void testBudget(void) {
+    static const char* sweeps[] = { "+[>+]", "+[>+[-]+]", "+[<+]" };
+    hostOut o = { 0, 0, 0, -1 };
+    bf_VM vm, *a;
+    char name[64];
+    int i, n, st, ok;
+
+    for (i = 0; i < 3; i++) {
+        bf_VM_alloc(&vm);
+        bf_VM_tapeReserve(&vm, BF_TAPE_SPARSE_RESERVE, bf_TAPE_SPARSE);
+        bf_VM_compile(&vm, sweeps[i], strlen(sweeps[i]), 0, 0);
+        st = bffsree_Eval(&vm, 0, 10000);
+        ok = st == bf_EVAL_BUDGET && vm.touchHi - vm.touchLo <= 10000 + 16;
+        st = bffsree_Eval(&vm, 0, 10000);
+        ok = ok && st == bf_EVAL_BUDGET && vm.touchHi - vm.touchLo <= 20000 + 16;
+        bf_VM_free(&vm);
+        snprintf(name, sizeof(name), "budget: %s yields", sweeps[i]);
+        hostCheck(name, ok);
+    }
+
+    // a small tape: a few steps a call (2000 cells to its end), then the
+    // fault on the call that steps off it
+    bf_VM_alloc(&vm);
+    bf_VM_tapeReserve(&vm, 4000, 0);
+    bf_VM_compile(&vm, "+[>+]", 5, 0, 0);
+    for (n = 0; (st = bffsree_Eval(&vm, 0, 1)) == bf_EVAL_BUDGET && n < 10000; n++) {}
+    bf_VM_free(&vm);
+    hostCheck("budget: icount 1 on a 4000-cell tape", st == bf_EVAL_ERROR && n >= 500 && n <= 2100);
+
+    // a VM suspended on a full buffer, released and acquired again
+    a = bf_VM_acquire();
+    a->writep = hostRefuse;
+    bf_VM_compile(a, "+[.]", 4, 0, 0);
+    st = bffsree_Eval(a, 0, 1 << 30);
+    bf_VM_release(a);
+    a = bf_VM_acquire();
+    hostSink(a, &o);
+    bf_VM_compile(a, "++++++++[>++++++++<-]>+.", 24, 0, 0);
+    ok = st == bf_EVAL_OUTPUT && hostRun(a, 1 << 30) == bf_EVAL_EOP && hostIs(&o, "A", 1);
+    bf_VM_release(a);
+    hostCheck("reset: suspended output is dropped", ok);
+    bf_VM_poolDrain();
+    free(o.b);
+}
+
+// =====================================================================
+// suspension: 1000 VMs on one thread, each a cat fed a line in three
+// pieces and then 10000 bytes, through sinks that take 1000 bytes a round
+// =====================================================================
+#define HOST_VMS 1000
+
+static void testSuspend(void) {
+    static const char* pieces[] = { "hel", "lo, wo", "rld\n" };
+    bf_Program* p = bf_Program_compile(",+[-.,+]", 8, 0, 0);
+    bf_VM* vms = (bf_VM*)calloc(HOST_VMS, sizeof(bf_VM));
+    hostIn* ins = (hostIn*)calloc(HOST_VMS, sizeof(hostIn));
+    hostOut* outs = (hostOut*)calloc(HOST_VMS, sizeof(hostOut));
+    int* st = (int*)calloc(HOST_VMS, sizeof(int));
+    char *block = (char*)malloc(10000), *want = (char*)malloc(10000 + 16);
+    long nIn = 0, nOut = 0;
+    int i, r, live = HOST_VMS, ok = 1;
+
+    for (i = 0; i < 10000; i++) block[i] = (char)('a' + i % 26);
+    strcpy(want, "hello, world\n");
+    memcpy(want + 13, block, 10000);
+    for (i = 0; i < HOST_VMS; i++) {
+        bf_VM_alloc(&vms[i]);
+        bf_VM_tapeReserve(&vms[i], 4096, 0);
+        bf_VM_load(&vms[i], p);
+        vms[i].readp = hostRead; vms[i].readdata = &ins[i];
+        hostSink(&vms[i], &outs[i]);
+        st[i] = bf_EVAL_BUDGET;
+    }
+    for (r = 0; live > 0 && r < 100; r++) {
+        for (i = 0; i < HOST_VMS; i++) {
+            if ((st[i] == bf_EVAL_EOP || st[i] == bf_EVAL_ERROR) && !vms[i].outLen) continue;
+            if (r < 3)       { ins[i].p = pieces[r]; ins[i].n = strlen(pieces[r]); }
+            else if (r == 3) { ins[i].p = block; ins[i].n = 10000; }
+            else             ins[i].eof = 1;
+            outs[i].room = 1000;
+            while ((st[i] = bffsree_Eval(&vms[i], 0, 1 << 30)) == bf_EVAL_BUDGET) {}
+            if (st[i] == bf_EVAL_INPUT) nIn++;
+            if (st[i] == bf_EVAL_OUTPUT) nOut++;
+            // an ended VM may still hold output: Eval hands it on again
+            if ((st[i] == bf_EVAL_EOP || st[i] == bf_EVAL_ERROR) && !vms[i].outLen) live--;
+        }
+    }
+    for (i = 0; i < HOST_VMS; i++) {
+        ok = ok && st[i] == bf_EVAL_EOP && hostIs(&outs[i], want, 10000 + 13);
+        bf_VM_free(&vms[i]);
+        free(outs[i].b);
+    }
+    hostCheck("suspend: 1000 cats, in and out waits", ok && nIn >= 3 * HOST_VMS && nOut >= 5 * HOST_VMS);
+    bf_Program_release(p);
+    free(vms); free(ins); free(outs); free(st); free(block); free(want);
+}
+
+// =====================================================================
+// shared program: one bf_Program, loaded into pooled VMs on 4 threads
+// =====================================================================
+#define HOST_THREADS 4
+#define HOST_ROUNDS  2000
+
+typedef struct hostShare { bf_Program* p; int ok; } hostShare;
+
+BF_THREAD_PROC(hostShareRun, arg) {
+    hostShare* sh = (hostShare*)arg;
+    hostOut o = { 0, 0, 0, -1 };
+    hostIn eof = { 0, 0, 1 };
+    bf_VM* vm;
+    int i;
+
+    for (i = 0; i < HOST_ROUNDS && sh->ok; i++) {
+        o.n = 0;
+        vm = bf_VM_acquire();
+        hostSink(vm, &o);
+        vm->readp = hostRead; vm->readdata = &eof;     // past the '!' input
+        bf_VM_load(vm, sh->p);
+        sh->ok = hostRun(vm, 1 << 30) == bf_EVAL_EOP && hostIs(&o, "Hi, there\n", 10);
+        bf_VM_release(vm);
+    }
+    bf_VM_poolDrain();
+    free(o.b);
+    return 0;
+}
+
+static void testShared(void) {
+    // echoes the program's own '!' input, which the program keeps a copy of
+    static const char src[] = ",+[-.,+]!Hi, there\n";
+    hostShare sh[HOST_THREADS];
+    bf_thread th[HOST_THREADS];
+    int i, n, ok = 1;
+
+    sh[0].p = bf_Program_compile(src, strlen(src), 0, 0);
+    for (n = 0; n < HOST_THREADS; n++) {
+        sh[n].p = sh[0].p;
+        sh[n].ok = 1;
+        if (!bf_threadStart(&th[n], hostShareRun, &sh[n])) break;
+    }
+    for (i = 0; i < n; i++) { bf_threadJoin(th[i]); ok = ok && sh[i].ok; }
+    ok = ok && n == HOST_THREADS && sh[0].p->refs == 1;
+    bf_Program_release(sh[0].p);
+    hostCheck("shared: one program on 4 threads", ok);
+}
+
+// =====================================================================
+// scheduler: one worker shared by a tape sweep, short programs, a spin
+// stopped by its fuel, a cat on a non-blocking pipe and one fed by the
+// host through bf_Sched_wake
+// =====================================================================
+#define HOST_SHORT 20
+
+static void hostSleep(int ms) {
+#if defined(_WIN32)
+    Sleep((DWORD)ms);
+#else
+    struct timespec ts;
+    ts.tv_sec = 0;
+    ts.tv_nsec = (long)ms * 1000000L;
+    nanosleep(&ts, 0);
+#endif
+}
+
+static int hostDoneN;
+
+static void hostDone(bf_Task* t) {
+    *(int*)t->user = bf_atomicInc(&hostDoneN);
+}
+
+// input the host hands over from another thread: BF_AGAIN until it has
+typedef struct hostQueue { bf_mutex lock; char buf[64]; size_t pos, len; int eof; } hostQueue;
+
+static int hostQueueRead(void* data, char* buf, size_t n) {
+    hostQueue* q = (hostQueue*)data;
+    int r;
+    bf_lock(&q->lock);
+    if (n > q->len - q->pos) n = q->len - q->pos;
+    memcpy(buf, q->buf + q->pos, n);
+    q->pos += n;
+    r = n ? (int)n : q->eof ? 0 : BF_AGAIN;
+    bf_unlock(&q->lock);
+    return r;
+}
+
+static void hostTask(bf_Task* t, bf_VM* vm, const char* src, long long fuel, int* order, int sparse) {
+    bf_VM_alloc(vm);
+    bf_VM_tapeReserve(vm, sparse ? 1 << 24 : 4096, sparse ? bf_TAPE_SPARSE : 0);
+    bf_VM_compile(vm, src, strlen(src), 0, 0);
+    memset(t, 0, sizeof(*t));
+    t->vm = vm;
+    t->fuel = fuel;
+    t->fdIn = t->fdOut = -1;
+    t->done = hostDone;
+    t->user = order;
+}
+
+static void testSched(void) {
+    static const char* pieces[] = { "hel", "lo, wo", "rld\n" };
+    bf_Sched* s = bf_Sched_create(1, 1000);
+    bf_VM vms[HOST_SHORT + 4];
+    bf_Task ts[HOST_SHORT + 4];
+    hostOut outs[HOST_SHORT + 4];
+    int order[HOST_SHORT + 4];
+    hostQueue q;
+    bf_Task *sweep = &ts[0], *spin = &ts[1], *wake = &ts[2], *pipeT = &ts[3];
+    int i, ok, fair, pfd[2] = { -1, -1 };
+
+    memset(outs, 0, sizeof(outs));
+    memset(order, 0, sizeof(order));
+    memset(&q, 0, sizeof(q));
+    bf_mutexInit(&q.lock);
+    hostDoneN = 0;
+
+    // a sweep that reaches a fresh cell every iteration, until its fuel runs out
+    hostTask(sweep, &vms[0], "+[>+]", 200000, &order[0], 1);
+    hostTask(spin, &vms[1], "+[]", 50000, &order[1], 0);
+    hostTask(wake, &vms[2], ",+[-.,+]", 0, &order[2], 0);
+    vms[2].readp = hostQueueRead; vms[2].readdata = &q;
+    hostTask(pipeT, &vms[3], ",+[-.,+]", 0, &order[3], 0);
+#if !defined(_WIN32)
+    if (pipe(pfd) == 0) {
+        fcntl(pfd[0], F_SETFL, O_NONBLOCK);
+        vms[3].readp = bf_readFd; vms[3].readdata = (void*)(intptr_t)pfd[0];
+        pipeT->fdIn = pfd[0];
+    }
+#endif
+    for (i = 4; i < HOST_SHORT + 4; i++) hostTask(&ts[i], &vms[i], "++++++++[>++++++++<-]>+.", 0, &order[i], 0);
+    for (i = 0; i < HOST_SHORT + 4; i++) { outs[i].room = -1; hostSink(&vms[i], &outs[i]); }
+
+    ok = s != 0;
+    for (i = 0; ok && i < HOST_SHORT + 4; i++) {
+        if (i == 3 && pfd[0] < 0) continue;
+        ok = bf_Sched_spawn(s, &ts[i]) == 0;
+    }
+    // the cats get their line in pieces while the others run
+    for (i = 0; ok && i < 3; i++) {
+        hostSleep(2);
+        bf_lock(&q.lock);
+        memcpy(q.buf + q.len, pieces[i], strlen(pieces[i]));
+        q.len += strlen(pieces[i]);
+        bf_unlock(&q.lock);
+        bf_Sched_wake(wake);
+#if !defined(_WIN32)
+        if (pfd[1] >= 0 && write(pfd[1], pieces[i], strlen(pieces[i])) < 0) ok = 0;
+#endif
+    }
+    bf_lock(&q.lock);
+    q.eof = 1;
+    bf_unlock(&q.lock);
+    if (ok) bf_Sched_wake(wake);
+#if !defined(_WIN32)
+    if (pfd[1] >= 0) close(pfd[1]);
+#endif
+    if (ok) bf_Sched_wait(s);
+    bf_Sched_destroy(s);
+
+    for (i = 4, fair = ok; fair && i < HOST_SHORT + 4; i++)
+        fair = ts[i].st == bf_EVAL_EOP && hostIs(&outs[i], "A", 1) && order[i] < order[0];
+    hostCheck("sched: short tasks pass a sweep", fair && sweep->st == bf_EVAL_BUDGET);
+    hostCheck("sched: fuel stops a spin", ok && spin->st == bf_EVAL_BUDGET);
+    hostCheck("sched: bf_Sched_wake feeds a cat", ok && wake->st == bf_EVAL_EOP && hostIs(&outs[2], "hello, world\n", 13));
+#if !defined(_WIN32)
+    hostCheck("sched: poller feeds a cat on a pipe", ok && pipeT->st == bf_EVAL_EOP && hostIs(&outs[3], "hello, world\n", 13));
+    if (pfd[0] >= 0) close(pfd[0]);
+#endif
+    for (i = 0; i < HOST_SHORT + 4; i++) { bf_VM_free(&vms[i]); free(outs[i].b); }
+    bf_mutexFree(&q.lock);
+}
+
+int main(void) {
+    testPool();
+    testBudget();
+    testSuspend();
+    testShared();
+    testSched();
+    printf("----------------------------------------------\n");
+    printf("%s\n", hostFails ? "host tests FAILED" : "all host tests passed");
+    return hostFails ? 1 : 0;
+}
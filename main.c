@@ -24,18 +24,13 @@ void bffsree_Print(bf_VM* vm, char* inp, int lang) {
         return;
     }
 
-    static const char* op_names[] = {
-        "NOOP", "VAL", "PUT", "GET", "FWD", "REW",
-        "PTR_S", "MUL_MUL", "VAL_MZ", "VAL_MUL", "VAL_ZERO", "DEBUG", "EOP"
-    };
-
     if (lang == 0) {
         // JSON output
         printf("[\n");
         for (i = 0; i < vm->progLen_op; i++) {
-            const char* name = (bfo[i].cmd < bfo_Total) ? op_names[bfo[i].cmd] : "???";
-            printf("  { \"op\": \"%s\", \"val\": %d, \"off\": %d, \"buf\": %d }%s\n",
-                   name, bfo[i].val, bfo[i].off, bfo[i].buf,
+            const char* name = bf_opName(bfo[i].cmd);
+            printf("  { \"op\": \"%s\", \"val\": %d, \"off\": %d, \"buf\": %d, \"arg\": %d }%s\n",
+                   name, bfo[i].val, bfo[i].off, bfo[i].buf, bfo[i].arg,
                    (i < vm->progLen_op - 1) ? "," : "");
         }
         printf("]\n");
@@ -43,9 +38,9 @@ void bffsree_Print(bf_VM* vm, char* inp, int lang) {
         // C-like output
         printf("// Optimized IR (%d ops):\n", vm->progLen_op);
         for (i = 0; i < vm->progLen_op; i++) {
-            const char* name = (bfo[i].cmd < bfo_Total) ? op_names[bfo[i].cmd] : "???";
-            printf("  [%3d] %-10s val=%-6d off=%-4d buf=%d\n",
-                   i, name, bfo[i].val, bfo[i].off, bfo[i].buf);
+            const char* name = bf_opName(bfo[i].cmd);
+            printf("  [%3d] %-10s val=%-6d off=%-4d buf=%-6d arg=%d\n",
+                   i, name, bfo[i].val, bfo[i].off, bfo[i].buf, bfo[i].arg);
         }
     }
 }
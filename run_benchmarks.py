@@ -114,6 +114,342 @@ def run_benchmark(name, bfile, input_data="", expected_output=None, expected_fil
     print(f"{elapsed:8.3f}s  [{status}]")
     return elapsed, passed
 
+def compile_benchmarks():
+    """Time compiling deep synthetic loop nests (cell 0 is zero, so none of them runs)"""
+    import tempfile
+    nests = [
+        ("deep [[[+]]]",            lambda d: "[" * d + "+" + "]" * d),
+        ("bodies [>+< ... -]",      lambda d: "[>+<" * d + "-]" * d),
+        ("multiply [->+>++<< ... ]", lambda d: "[->+>++<<" * d + "]" * d),
+    ]
+    depths = [1000, 10000, 100000]
+
+    print("Compile time (deep nests)...")
+    print("----------------------------------------------")
+    print(f"{'Nest':25} " + " ".join(f"{d:>9}" for d in depths))
+    print("----------------------------------------------")
+    all_passed = True
+    with tempfile.TemporaryDirectory() as tmp:
+        for name, gen in nests:
+            print(f"{name:25}", end="", flush=True)
+            for d in depths:
+                path = os.path.join(tmp, "nest.b")
+                with open(path, "w") as f:
+                    f.write(gen(d))
+                start = time.perf_counter()
+                try:
+                    result = subprocess.run([BFFSREE, path], stdin=subprocess.DEVNULL,
+                                            capture_output=True, timeout=300)
+                    ok = result.returncode == 0 and result.stdout == b""
+                except subprocess.TimeoutExpired:
+                    ok = False
+                elapsed = time.perf_counter() - start
+                all_passed = all_passed and ok
+                print(f" {elapsed:8.3f}s" if ok else f" {RED}{'FAIL':>8}{NC}", end="", flush=True)
+            print()
+    print("----------------------------------------------")
+    return all_passed
+
+def tape_benchmarks(runs=3):
+    """Time a strided scan of a large tape with and without huge pages (-H)"""
+    import tempfile
+    # 65280 ones 127 cells apart (33MB of tape with `make cell32`), then
+    # 1020 walks [>..>] / [<..<] over them: a new 4KB page every few steps
+    step, outer, block, rounds = 127, 255, 256, 4
+    r, l = ">" * step, "<" * step
+    fill = "<" + "+" * outer + "[>" + r + "[" + r + "]" + ("+" + r) * block + l + "[" + l + "]<-]"
+    scan = "<" + "+" * rounds + "[<" + "+" * 255 + "[>>>" + r + "[" + r + "]" + l + "[" + l + "]<<<-]>-]"
+
+    print("Large tape (strided scan; build with `make cell32`)...")
+    print("----------------------------------------------")
+    all_passed = True
+    with tempfile.TemporaryDirectory() as tmp:
+        path = os.path.join(tmp, "scan.b")
+        with open(path, "w") as f:
+            f.write(fill + scan)
+        for name, flags in (("4KB pages", []), ("huge pages (-H)", ["-H"])):
+            print(f"{name:25}", end="", flush=True)
+            best, report = None, ""
+            for _ in range(runs):
+                start = time.perf_counter()
+                try:
+                    result = subprocess.run([BFFSREE, "-m"] + flags + [path], stdin=subprocess.DEVNULL,
+                                            capture_output=True, timeout=300)
+                    ok = result.returncode == 0 and b"exception" not in result.stdout
+                except subprocess.TimeoutExpired:
+                    ok = False
+                elapsed = time.perf_counter() - start
+                if not ok:
+                    break
+                best = elapsed if best is None else min(best, elapsed)
+                report = [ln for ln in result.stdout.decode(errors="replace").split("\n")
+                          if ln.startswith("//-- Huge pages")]
+            all_passed = all_passed and ok
+            if ok:
+                print(f"{best:8.3f}s  " + (report[0][5:] if report else ""))
+            else:
+                print(f"{RED}{'FAIL':>9}{NC}")
+    print("----------------------------------------------")
+    return all_passed
+
+def io_benchmarks(runs=5):
+    """Output and input throughput: stdio vs bf_Stream (-U, io_uring where available)"""
+    import tempfile
+    # 4*255^3 = 66MB of 'A'; a cat filter (EOF is -1, so +1 ends the loop)
+    emit = "++++++++[>++++++++<-]>+>++++[>-[>-[>-[<<<<.>>>>-]<-]<-]<-]"
+    cat = ",+[-.,+]"
+    size = 4 * 255 ** 3
+
+    def timed(cmd, stdin, sink):
+        start = time.perf_counter()
+        if sink == "pipe":
+            proc = subprocess.Popen(cmd, stdin=stdin, stdout=subprocess.PIPE)
+            n = 0
+            while True:
+                chunk = proc.stdout.read(1 << 20)
+                if not chunk:
+                    break
+                n += len(chunk)
+            ok = proc.wait() == 0 and n == size
+        else:
+            ok = subprocess.run(cmd, stdin=stdin, stdout=subprocess.DEVNULL, timeout=300).returncode == 0
+        return time.perf_counter() - start, ok
+
+    print("I/O throughput (MB/s, best of %d)..." % runs)
+    print("----------------------------------------------")
+    print(f"{'Case':25} {'stdio':>9} {'-U':>9}")
+    print("----------------------------------------------")
+    all_passed = True
+    with tempfile.TemporaryDirectory() as tmp:
+        files = {}
+        for name, src in (("emit", emit), ("cat", cat)):
+            files[name] = os.path.join(tmp, name + ".b")
+            with open(files[name], "w") as f:
+                f.write(src)
+        data = os.path.join(tmp, "in.txt")
+        with open(data, "wb") as f:
+            f.write(b"0123456789abcdef" * (size // 16) + b"0123456789abcdef"[:size % 16])
+        cases = [
+            ("output -> /dev/null", "emit", None, "null"),
+            ("output -> pipe", "emit", None, "pipe"),
+            ("file -> cat -> pipe", "cat", data, "pipe"),
+        ]
+        for name, prog, infile, sink in cases:
+            print(f"{name:25}", end="", flush=True)
+            for flags in ([], ["-U"]):
+                best = None
+                for _ in range(runs):
+                    with open(infile if infile else os.devnull, "rb") as fin:
+                        elapsed, ok = timed([BFFSREE] + flags + [files[prog]], fin, sink)
+                    all_passed = all_passed and ok
+                    best = elapsed if best is None else min(best, elapsed)
+                print(f" {size / best / 1e6:9.1f}", end="", flush=True)
+            print()
+    print("----------------------------------------------")
+    return all_passed
+
+def batch_benchmarks(jobs=200):
+    """Many short jobs: a process per job vs one --batch run (shared compiles, thread pool)"""
+    import tempfile
+    progs = [("hello", "++++++++[>++++[>++>+++>+++>+<<<<-]>+>+>->>+[<]<-]>>.>---.+++++++..+++.>>.<-.<.+++.------.--------.>>+.>++."),
+             ("beer", None), ("cat", ",+[-.,+]")]
+
+    print("Batch of %d short jobs..." % jobs)
+    print("----------------------------------------------")
+    all_passed = True
+    with tempfile.TemporaryDirectory() as tmp:
+        paths = {}
+        for name, src in progs:
+            paths[name] = os.path.join(BENCH_DIR, "beer.b") if src is None else os.path.join(tmp, name + ".b")
+            if src is not None:
+                with open(paths[name], "w") as f:
+                    f.write(src)
+        data = os.path.join(tmp, "in.txt")
+        with open(data, "wb") as f:
+            f.write(b"0123456789abcdef" * 4096)
+        lines = []
+        for i in range(jobs):
+            name = progs[i % len(progs)][0]
+            lines.append((paths[name], data if name == "cat" else "-", os.path.join(tmp, "out%d" % i)))
+        manifest = os.path.join(tmp, "manifest.txt")
+        with open(manifest, "w") as f:
+            f.write("".join("%s %s %s\n" % ln for ln in lines))
+
+        start = time.perf_counter()
+        for prog, infile, outfile in lines:
+            with open(infile if infile != "-" else os.devnull, "rb") as fin, open(outfile, "wb") as fout:
+                subprocess.run([BFFSREE, prog], stdin=fin, stdout=fout, timeout=60)
+        elapsed = time.perf_counter() - start
+        expected = []
+        for _, _, outfile in lines:
+            with open(outfile, "rb") as f:
+                expected.append(f.read())
+        print(f"{'process per job':25} {elapsed:8.3f}s")
+
+        for name, flags in (("--batch -j 1", ["-j", "1"]), ("--batch", [])):
+            start = time.perf_counter()
+            result = subprocess.run([BFFSREE, "--batch", manifest] + flags, capture_output=True, timeout=300)
+            elapsed = time.perf_counter() - start
+            ok = result.returncode == 0
+            for (_, _, outfile), want in zip(lines, expected):
+                with open(outfile, "rb") as f:
+                    ok = ok and f.read() == want
+            all_passed = all_passed and ok
+            report = [ln for ln in result.stdout.decode(errors="replace").split("\n") if ln.startswith("//-- batch")]
+            if ok:
+                print(f"{name:25} {elapsed:8.3f}s  " + (report[0][12:] if report else ""))
+            else:
+                print(f"{name:25} {RED}{'FAIL':>9}{NC}")
+    print("----------------------------------------------")
+    return all_passed
+
+def lanes_benchmarks(runs=64):
+    """One program over many inputs: --batch -j 1 (a VM per input) vs --lanes (lockstep)"""
+    import tempfile, random
+    random.seed(1)
+    cases = [("long.b, same input", "long.b", [""] * runs),
+             ("factor.b, own input", "factor.b", [str(random.randint(2, 10**7)) for _ in range(runs)])]
+
+    print("%d runs per program, --batch -j 1 vs --lanes..." % runs)
+    print("----------------------------------------------")
+    all_passed = True
+    with tempfile.TemporaryDirectory() as tmp:
+        for label, prog, inputs in cases:
+            prog = os.path.join(BENCH_DIR, prog)
+            lines = []
+            for i, text in enumerate(inputs):
+                path = os.path.join(tmp, "in%d" % i)
+                with open(path, "w") as f:
+                    f.write(text + "\n")
+                lines.append("%s %s %s.out\n" % (prog, path, path))
+            manifest = os.path.join(tmp, "manifest.txt")
+            with open(manifest, "w") as f:
+                f.write("".join(lines))
+
+            start = time.perf_counter()
+            result = subprocess.run([BFFSREE, "--batch", manifest, "-j", "1"], capture_output=True, timeout=600)
+            elapsed = time.perf_counter() - start
+            expected = b""
+            for i in range(len(inputs)):
+                with open(os.path.join(tmp, "in%d.out" % i), "rb") as f:
+                    expected += f.read()
+            print(f"{label:25} {'batch':>6} {elapsed:8.3f}s")
+
+            for width in (8, 32):
+                start = time.perf_counter()
+                result = subprocess.run([BFFSREE, "--lanes", str(width), "-m", prog], capture_output=True,
+                                        input="".join(t + "\n" for t in inputs).encode(), timeout=600)
+                elapsed = time.perf_counter() - start
+                out = result.stdout.split(b"//-- Lanes")
+                ok = result.returncode == 0 and out[0] == expected
+                all_passed = all_passed and ok
+                if ok:
+                    print(f"{'':25} {width:6} {elapsed:8.3f}s  " + out[1].decode(errors="replace").strip(": \n"))
+                else:
+                    print(f"{'':25} {width:6} {RED}{'FAIL':>9}{NC}")
+    print("----------------------------------------------")
+    return all_passed
+
+def pipeline_benchmarks(runs=3):
+    """Chained filters: shell pipes between processes vs one --pipeline run (threads and rings)"""
+    import tempfile, shlex
+    # +1 and -1 on every byte; the data has no bytes a stage would take for EOF
+    progs = {"inc": ",+[.,+]", "dec": ",+[--.+,+]", "cat": ",+[-.,+]"}
+    size = 16 << 20
+
+    print("Pipelines over %d MB (MB/s, best of %d)..." % (size >> 20, runs))
+    print("----------------------------------------------")
+    print(f"{'Stages':25} {'sh pipe':>9} {'sh -U':>9} {'--pipe':>9} {'--pipe -U':>9}")
+    print("----------------------------------------------")
+    all_passed = True
+    with tempfile.TemporaryDirectory() as tmp:
+        for name, src in progs.items():
+            with open(os.path.join(tmp, name + ".b"), "w") as f:
+                f.write(src)
+        data = os.path.join(tmp, "in.bin")
+        with open(data, "wb") as f:
+            f.write(bytes(range(1, 254)) * (size // 253) + bytes(range(1, 254))[:size % 253])
+        with open(data, "rb") as f:
+            want = f.read()
+        for label, chain in (("cat | cat", ["cat", "cat"]), ("(inc | dec) x2", ["inc", "dec"] * 2),
+                             ("(inc | dec) x4", ["inc", "dec"] * 4)):
+            paths = [os.path.join(tmp, name + ".b") for name in chain]
+            print(f"{label:25}", end="", flush=True)
+            cmds = [" | ".join(shlex.quote(BFFSREE) + " " + shlex.quote(p) for p in paths),
+                    " | ".join(shlex.quote(BFFSREE) + " -U " + shlex.quote(p) for p in paths),
+                    shlex.quote(BFFSREE) + " --pipeline " + " ".join(shlex.quote(p) for p in paths),
+                    shlex.quote(BFFSREE) + " -U --pipeline " + " ".join(shlex.quote(p) for p in paths)]
+            for cmd in cmds:
+                best = None
+                for _ in range(runs):
+                    with open(data, "rb") as fin:
+                        start = time.perf_counter()
+                        result = subprocess.run(cmd, shell=True, stdin=fin, capture_output=True, timeout=300)
+                        elapsed = time.perf_counter() - start
+                    ok = result.returncode == 0 and result.stdout == want
+                    all_passed = all_passed and ok
+                    best = elapsed if best is None else min(best, elapsed)
+                print(f" {size / best / 1e6:9.1f}" if ok else f" {RED}{'FAIL':>9}{NC}", end="", flush=True)
+            print()
+    print("----------------------------------------------")
+    return all_passed
+
+# Programs the optimizer once got wrong: (name, build flags, program, input,
+# exact stdout). Flags other than "" build their own binary from main.c.
+REGRESSIONS = [
+    ("odd-step loop, inner move",  "", "--->+++<[+>[->+<]<]>>.", b"", b"\x03"),
+    ("odd-step loop, inner move 2", "", ">+>--[+<[->>+<<]>]<.>.>.", b"", b"\x00\x00\x01"),
+    # 251 / 3 with signed cells: the divmod idiom must stay a loop
+    ("divmod, signed cells",        "-DBF_CELL_SIGNED=1",
+     "----->+++<[->-[>+>>]>[+[-<+>]>+>>]<<<<<].>.>.>.>.", b"", b"\x00\x01\x02\x53\x00"),
+    ("divmod keeping n, signed",    "-DBF_CELL_SIGNED=1",
+     "----->>+++<<[->+>-[>+>>]>[+[-<+>]>+>>]<<<<<<].>.>.>.>.>.", b"", b"\x00\xfb\x01\x02\x53\x00"),
+    # 64-bit cells: a cell vector no longer fills whole op slots
+    ("MEM_VEC pool, 64-bit cells",  "-DBF_CELL_BITS=64",
+     "+>++>+++>++++>+++++>++++++>+++++++>++++++++<<<<<<<.>.>.>.>.>.>.>.>>>>+++>+++>+++>+++>+++>+++>++<<<<<<.>.>.>.>.>.>.",
+     b"", bytes([1, 2, 3, 4, 5, 6, 7, 8, 3, 3, 3, 3, 3, 3, 2])),
+    ("MUL_VEC pool, 64-bit cells",  "-DBF_CELL_BITS=64",
+     "++[->+>++>+++>++++>+++++<<<<<]+++[->+>++>+++>++++>+++++<<<<<]>.>.>.>.>.", b"", b"\x05\x0a\x0f\x14\x19"),
+    # 4096-cell tape starting at 2048: the walk's adds land left of cell 0
+    ("add walk past the tape start", "-DBF_TAPE_RESERVE=4096",
+     "<" * 2048 + "+>+>+<<[<<<<+>>>>>].", b"", b"// memory exception\n"),
+    # scans that run off either end of the tape
+    ("scan past the tape end",       "-DBF_TAPE_RESERVE=4096", "+[>-[>]<]", b"", b"// memory exception\n"),
+    ("scan past the tape start",     "-DBF_TAPE_RESERVE=4096", "+[<-[<]>]", b"", b"// memory exception\n"),
+    # a loop drifting right whose inner move writes two cells ahead of sp
+    ("move target past the tape end", "-DBF_TAPE_RESERVE=4096",
+     "----->++>+>+++><<<<[----->>---->[->>+<<]<<]>.>.>.>.>.>.", b"", b"// memory exception\n"),
+]
+
+def regression_tests():
+    """Small programs with known output, each under the build it needs"""
+    import tempfile
+    print("Regression tests...")
+    print("----------------------------------------------")
+    all_passed = True
+    with tempfile.TemporaryDirectory() as tmp:
+        binaries = {"": BFFSREE}
+        for name, flags, src, data, want in REGRESSIONS:
+            print(f"{name:32}", end="", flush=True)
+            if flags not in binaries:
+                exe = os.path.join(tmp, "bffsree%d" % len(binaries))
+                subprocess.run(["gcc", "-O2"] + flags.split() + ["-o", exe, "main.c", "-pthread"],
+                               cwd=SCRIPT_DIR, check=True)
+                binaries[flags] = exe
+            prog = os.path.join(tmp, "t.b")
+            with open(prog, "w") as f:
+                f.write(src)
+            try:
+                result = subprocess.run([binaries[flags], prog], input=data, capture_output=True, timeout=60)
+                ok = result.returncode == 0 and result.stdout == want
+                got = result.stdout if result.returncode >= 0 else b"signal %d" % -result.returncode
+            except subprocess.TimeoutExpired:
+                ok, got = False, b"timeout"
+            all_passed = all_passed and ok
+            print(f"[{GREEN}PASS{NC}]" if ok else f"[{RED}FAIL{NC}] got {got[:40]!r}")
+    print("----------------------------------------------")
+    return all_passed
+
 def main():
     force_build = "-b" in sys.argv or "--build" in sys.argv
     
@@ -128,6 +464,21 @@ def main():
         print(f"{RED}Error: bffsree executable not found{NC}")
         sys.exit(1)
     
+    if "--regress" in sys.argv:
+        sys.exit(0 if regression_tests() else 1)
+    if "--compile" in sys.argv:
+        sys.exit(0 if compile_benchmarks() else 1)
+    if "--tape" in sys.argv:
+        sys.exit(0 if tape_benchmarks() else 1)
+    if "--io" in sys.argv:
+        sys.exit(0 if io_benchmarks() else 1)
+    if "--batch" in sys.argv:
+        sys.exit(0 if batch_benchmarks() else 1)
+    if "--lanes" in sys.argv:
+        sys.exit(0 if lanes_benchmarks() else 1)
+    if "--pipeline" in sys.argv:
+        sys.exit(0 if pipeline_benchmarks() else 1)
+
     print("Running benchmarks...")
     print("----------------------------------------------")
     print(f"{'Test':25} {'Time':>9}  Status")